@@ -22,26 +22,61 @@
 NWK Layer
 ZigBee Specification  260
 
+JDone status: 0 -   , 1 -  , 2 -    ,
+3 -            
 
+Channel 0:      NWK_SCAN_CHANNELS  NWK_SCAN_DURATION ms
+       ,         
 
  **********************************************************************************/
  
 uint8_t NWK_Join(uint16_t PANID, uint8_t Channel,uint8_t Duration,
 EVENT (*JDone)(uint8_t status, uint16_t NetAdd, uint8_t Hello, uint8_t Module),
-EVENT (*NWK_RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint8_t NsduLength, uint8_t *NsduData,
+EVENT (*NWK_RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint16_t NsduLength, uint8_t *NsduData,
 uint8_t LinkQuality,uint64_t RxTime ));
 
 
 uint8_t NWK_StartCrd(uint16_t PANID,uint8_t Channel,uint8_t HelloInterval,uint8_t Module,
-EVENT (*NWK_RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint8_t NsduLength, uint8_t *NsduData,
+EVENT (*NWK_RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint16_t NsduLength, uint8_t *NsduData,
 uint8_t LinkQuality,uint64_t RxTime ));
  
 
-RESULT NWK_Data_Tx(uint16_t DstAddr, uint8_t NsduLength, uint8_t NsduHandle, uint8_t *NsduData,
+// NSDU      , NsduData     NWK_TxDone,
+//       NSDU;   ,  
+// NWK_REASSEMBLY_POOL_SIZE  0
+RESULT NWK_Data_Tx(uint16_t DstAddr, uint16_t NsduLength, uint8_t NsduHandle, uint8_t *NsduData,
  EVENT (*NWK_TxDone)(BOOL status, uint8_t NsduHandle, uint64_t TxTime));
 
+//   NSDU   Root    , Root=0 -  .
+//    ,     . Radius -  
+//      , NSDU    .   NWK_RxDone
+//    0xFFFF
+RESULT NWK_Broadcast_Tx(uint16_t Root, uint8_t Radius, uint16_t NsduLength, uint8_t NsduHandle, uint8_t *NsduData,
+ EVENT (*NWK_TxDone)(BOOL status, uint8_t NsduHandle, uint64_t TxTime));
+
+
+
+
+//  ,        
+typedef struct {
+uint16_t NetAdd;             //  , 0xFFFF  
+uint64_t LongAdd;            // IEEE , 0  
+uint8_t LQI;                 //  LQI
+int8_t RSSI;                 //  RSSI, dBm
+uint8_t TxRatio;             //   , 255 -   
+uint64_t LastHeard;          //     (SFD), 
+} NWKNeighbour;
+
+//        (0..NWK_NEIGHBOUR_TABLE_SIZE-1),
+// FAIL   
+RESULT NWK_GetNeighbour(uint8_t Index, NWKNeighbour *Neighbour);
 
+//     , FAIL    
+RESULT NWK_FindNeighbour(uint16_t NetAdd, NWKNeighbour *Neighbour);
 
+//   : RxDrops -      ,
+// RadiusDrops -  ,     ( )
+RESULT NWK_GetDropCounts(uint16_t *RxDrops, uint16_t *RadiusDrops);
 
 //   
 
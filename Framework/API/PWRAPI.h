@@ -0,0 +1,27 @@
+/**
+ * @file PWRAPI.h
+ * Power management API.
+ * @author Nezametdinov I.E.
+ */
+
+#ifndef __PWR_API_H__
+#define __PWR_API_H__
+
+#include "../PIL/Defs.h"
+
+/*******************************************************************************//**
+ * allows or forbids OS to enter power save mode when there are no ready threads
+ * and the next timer deadline is far enough, radio transceiver and UART do not
+ * receive anything while OS is in power save mode
+ * @param[in] Enable TRUE to allow power save mode, FALSE to use idle mode only
+ **********************************************************************************/
+void PWR_SetAutoPowerSave(BOOL Enable);
+
+/*******************************************************************************//**
+ * returns state of automatic power save
+ * @return TRUE  if OS may enter power save mode automatically
+ * @return FALSE otherwise
+ **********************************************************************************/
+BOOL PWR_GetAutoPowerSave(void);
+
+#endif
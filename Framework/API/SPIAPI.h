@@ -27,6 +27,15 @@ enum
 	SPI_TRANSMISSION_MODE_ASYNC = 0x02
 };
 
+/// SPI speed
+enum
+{
+	/// normal speed
+	SPI_SPEED_NORMAL = 0x00,
+	/// double speed in master mode
+	SPI_SPEED_DOUBLE = 0x04
+};
+
 /// SPI handle
 typedef uint8_t HSPI;
 
@@ -74,4 +83,36 @@ RESULT SPI_Stop(HSPI SPI);
  **********************************************************************************/
 RESULT SPI_TxRx(HSPI SPI,uint8_t TxByte,uint8_t *RxByte);
 
+/*******************************************************************************//**
+ * transmits buffer via SPI, transmission must be sync
+ * @param[in] SPI    SPI handle
+ * @param[in] Length buffer length
+ * @param[in] TxBuf  buffer to send
+ * @return SUCCESS if buffer successfully transmitted
+ * @return FAIL    otherwise
+ **********************************************************************************/
+RESULT SPI_TxBuf(HSPI SPI,uint8_t Length,const uint8_t *TxBuf);
+
+/*******************************************************************************//**
+ * receives buffer via SPI sending zeros, transmission must be sync
+ * @param[in]  SPI    SPI handle
+ * @param[in]  Length buffer length
+ * @param[out] RxBuf  received bytes
+ * @return SUCCESS if buffer successfully received
+ * @return FAIL    otherwise
+ **********************************************************************************/
+RESULT SPI_RxBuf(HSPI SPI,uint8_t Length,uint8_t *RxBuf);
+
+/*******************************************************************************//**
+ * transmits buffer via SPI and receives bytes at the same time, transmission must
+ * be sync
+ * @param[in]  SPI    SPI handle
+ * @param[in]  Length buffers length
+ * @param[in]  TxBuf  buffer to send
+ * @param[out] RxBuf  received bytes, may be the same buffer as TxBuf
+ * @return SUCCESS if buffer successfully transmitted
+ * @return FAIL    otherwise
+ **********************************************************************************/
+RESULT SPI_TxRxBuf(HSPI SPI,uint8_t Length,const uint8_t *TxBuf,uint8_t *RxBuf);
+
 #endif
@@ -15,7 +15,22 @@ enum
 	/// task
 	THREAD_TASK_MODE    = 0x00,
 	/// process
-	THREAD_PROCESS_MODE = 0x01
+	THREAD_PROCESS_MODE = 0x01,
+	/// process wich runs only when posted
+	THREAD_EVENT_MODE   = 0x02
+};
+
+/// thread priority, ready threads with higher priority run first
+enum
+{
+	/// low (application threads)
+	THREAD_PRIORITY_LOW     = 0x00,
+	/// normal
+	THREAD_PRIORITY_NORMAL  = 0x04,
+	/// high
+	THREAD_PRIORITY_HIGH    = 0x08,
+	/// highest (radio transceiver)
+	THREAD_PRIORITY_HIGHEST = 0x0C
 };
 
 /// thread handle
@@ -41,12 +56,20 @@ RESULT Thread_Destroy(HThread Thread);
 /*******************************************************************************//**
  * starts the thread
  * @param[in] Thread thread handle
- * @param[in] Params thread parameters
+ * @param[in] Params thread mode combined with thread priority
  * @return SUCCESS if thread successfully started
  * @return FAIL    otherwise
  **********************************************************************************/
 RESULT Thread_Start(HThread Thread,uint8_t Params);
 
+/*******************************************************************************//**
+ * makes the active thread ready to run, may be called from interrupt
+ * @param[in] Thread thread handle
+ * @return SUCCESS if thread successfully posted
+ * @return FAIL    otherwise
+ **********************************************************************************/
+RESULT Thread_Post(HThread Thread);
+
 /*******************************************************************************//**
  * stops the thread
  * @param[in] Thread thread handle
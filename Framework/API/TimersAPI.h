@@ -18,6 +18,15 @@ enum
 	TIMER_CYCLIC_MODE   = 0x01
 };
 
+/// context of timer "fired" event handler
+enum
+{
+	/// event handler is run by scheduler
+	TIMER_THREAD_MODE    = 0x00,
+	/// event handler is run in interrupt, use it only for short and time critical handlers
+	TIMER_INTERRUPT_MODE = 0x02
+};
+
 /// timer handle
 typedef uint8_t HTimer;
 
@@ -41,7 +50,7 @@ RESULT Timer_Destroy(HTimer Timer);
 /*******************************************************************************//**
  * starts the timer
  * @param[in] Timer   timer handle
- * @param[in] Params  timer parameters
+ * @param[in] Params  timer mode combined with context of event handler
  * @param[in] Timeout timer timeout
  * @return SUCCESS if timer successfully started
  * @return FAIL    otherwise
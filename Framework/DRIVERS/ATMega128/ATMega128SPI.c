@@ -152,6 +152,12 @@ HSPI SPI_Open(uint8_t Channel,uint8_t Params,EVENT (*TxRxDone)(uint8_t Byte))
 		PORT_SPI |=  (1<<DD_SS);
 		SPCR     |=  (1<<SPE)|(1<<MSTR);
 		
+		// set SPI speed
+		if(Params&SPI_SPEED_DOUBLE)
+			SPSR |=  (1<<SPI2X);
+		else
+			SPSR &= ~(1<<SPI2X);
+		
 		// return SPI handle
 		return Channel;
 		
@@ -286,3 +292,98 @@ RESULT SPI_TxRx(HSPI SPI,uint8_t TxByte,uint8_t *RxByte)
 	// return success
 	return SUCCESS;
 }
+
+/*******************************************************************************//**
+ * transmits and receives buffer via SPI in sync mode
+ * @param[in]  SPI    SPI handle
+ * @param[in]  Length buffers length
+ * @param[in]  TxBuf  buffer to send, zeros are sent if it is NULL
+ * @param[out] RxBuf  received bytes, they are discarded if it is NULL
+ * @return SUCCESS if buffer successfully transmitted
+ * @return FAIL    otherwise
+ **********************************************************************************/
+static inline RESULT SPI_Transfer(HSPI SPI,uint8_t Length,const uint8_t *TxBuf,uint8_t *RxBuf)
+{
+	uint8_t i;
+	
+	// check SPI handle
+	if(SPI!=0)
+		return FAIL;
+	
+	// check state
+	if(!(SPCR&(1<<SPE)))
+		return FAIL;
+	
+	// buffers can be transmitted only in sync mode
+	if(SPI_IS_IN_ASYNC_MODE)
+		return FAIL;
+	
+	// if SPI is a system SPI and guard is watching for a threat
+	// then return failure
+	if(SPI_IS_SYSTEM_SPI&&Guard_IsWatching())
+		return FAIL;
+	
+	// nothing to transmit
+	if(Length==0)
+		return SUCCESS;
+	
+	// disable SPI interrupt
+	SPCR &= ~(1<<SPIE);
+	
+	// send the first byte
+	SPDR = (TxBuf!=NULL)?TxBuf[0]:0;
+	
+	// the next byte is sent as soon as the previous one is received
+	for(i=1;i<Length;++i)
+	{
+		while(!(SPSR&(1<<SPIF)));
+		if(RxBuf!=NULL)
+			RxBuf[i-1] = SPDR;
+		else
+			(void)SPDR;
+		SPDR = (TxBuf!=NULL)?TxBuf[i]:0;
+	}
+	
+	// wait for the last byte
+	while(!(SPSR&(1<<SPIF)));
+	if(RxBuf!=NULL)
+		RxBuf[Length-1] = SPDR;
+	else
+		(void)SPDR;
+	
+	// return success
+	return SUCCESS;
+}
+
+/*******************************************************************************//**
+ * @implements SPI_TxBuf
+ **********************************************************************************/
+RESULT SPI_TxBuf(HSPI SPI,uint8_t Length,const uint8_t *TxBuf)
+{
+	if(TxBuf==NULL)
+		return FAIL;
+	
+	return SPI_Transfer(SPI,Length,TxBuf,NULL);
+}
+
+/*******************************************************************************//**
+ * @implements SPI_RxBuf
+ **********************************************************************************/
+RESULT SPI_RxBuf(HSPI SPI,uint8_t Length,uint8_t *RxBuf)
+{
+	if(RxBuf==NULL)
+		return FAIL;
+	
+	return SPI_Transfer(SPI,Length,NULL,RxBuf);
+}
+
+/*******************************************************************************//**
+ * @implements SPI_TxRxBuf
+ **********************************************************************************/
+RESULT SPI_TxRxBuf(HSPI SPI,uint8_t Length,const uint8_t *TxBuf,uint8_t *RxBuf)
+{
+	if(TxBuf==NULL||RxBuf==NULL)
+		return FAIL;
+	
+	return SPI_Transfer(SPI,Length,TxBuf,RxBuf);
+}
@@ -12,6 +12,8 @@
 #include "../../API/SchedulerAPI.h"
 #include "../../API/CommonAPI.h"
 #include "../../PIL/SPI/SPI.h"
+#include "../../PIL/Utils.h"
+#include "../../PIL/Guard.h"
 
 #define CC2420_OPERATION_IS(x)   (CC2420Defs.Operation&(1<<x))
 #define CC2420_STOP_OPERATION(x) CC2420Defs.Operation &= ~(1<<x);
@@ -26,6 +28,11 @@
 #error Timers needed but not used
 #endif
 
+// transceiver sends ACK frames only if it checks CRC
+#if defined(PHY_LAYER_HANDLE_ACK)&&!defined(PHY_LAYER_HANDLE_CHECKSUM)
+#error PHY_LAYER_HANDLE_ACK needs PHY_LAYER_HANDLE_CHECKSUM
+#endif
+
 /// PHY layer operations
 enum
 {
@@ -39,6 +46,27 @@ enum
 	PHY_OPERATION_ATTR_VALID    = 7
 };
 
+/// RSSI reads used to seed random value generator
+enum
+{
+	/// max number of polls of RSSI_VALID status bit
+	CC2420_RSSI_VALID_POLLS = 100,
+	/// number of RSSI reads, each read takes a few micro seconds
+	CC2420_NOISE_READS      = 255
+};
+
+#ifdef PHY_LAYER_HANDLE_ACK
+/// timing of ACK frames sent by transceiver, in micro seconds
+enum
+{
+	/// duration of one byte
+	CC2420_BYTE_DURATION  = 2*PHY_SYMBOL_DURATION,
+	/// ACK SFD is sent 12 symbols of turnaround and 10 symbols of preamble
+	/// and SFD after received frame ends, SFD edges in this window belong to ACK
+	CC2420_ACK_SFD_WINDOW = 40*PHY_SYMBOL_DURATION
+};
+#endif
+
 /// CC2420 states
 typedef enum
 {
@@ -50,12 +78,45 @@ typedef enum
 	CC2420_STATE_IDLE               = 5,
 	CC2420_STATE_RX                 = 6,
 	CC2420_STATE_RX_GOT_SFD         = 7,
-	CC2420_STATE_RX_READING         = 8,
-	CC2420_STATE_RX_REJECT_ALL      = 9,
-	CC2420_STATE_TX                 = 10,
-	CC2420_STATE_TX_GOT_SFD         = 11
+	CC2420_STATE_RX_REJECT_ALL      = 8,
+	CC2420_STATE_TX                 = 9,
+	CC2420_STATE_TX_GOT_SFD         = 10,
+	CC2420_STATE_TX_STARTED         = 11
 }CC2420_STATE;
 
+#ifdef PHY_LAYER_HANDLE_CCA_TX
+/// CCA and tx request states
+typedef enum
+{
+	CC2420_CCA_TX_NONE      = 0,
+	CC2420_CCA_TX_REQUESTED = 1,
+	CC2420_CCA_TX_DONE      = 2
+}CC2420_CCA_TX_STATE;
+#endif
+
+/// structure defines received frame
+typedef struct
+{
+	/// frame data
+	uint8_t Data[PHY_A_MAX_PHY_PACKET_SIZE];
+	
+	/// frame length
+	uint8_t Length;
+	
+	/// link quality
+	uint8_t LQI;
+	
+	/// RSSI in dBm
+	int8_t RSSI;
+	
+	/// values for LQ calculation
+	uint16_t LQValues;
+	
+	/// SFD time
+	uint64_t SFDTime;
+	
+}CC2420RxFrame;
+
 /// structure defines CC2420 driver
 typedef struct
 {
@@ -83,6 +144,9 @@ typedef struct
 	/// last SFD time
 	uint64_t LastSFDTime;
 	
+	/// last RSSI
+	int8_t LastRSSI;
+	
 	/// values for LQ calculation
 	uint16_t LQValues;
 	
@@ -101,26 +165,96 @@ typedef struct
 	/// CCA mode
 	uint8_t  CCAMode;
 	
-	/// received data
-	uint8_t RxData[PHY_A_MAX_PHY_PACKET_SIZE];
-	uint8_t RxLen;
+	/// PAN ID
+	uint16_t PanID;
+	
+	/// short address
+	MAC_SHORT_ADDR ShortAddress;
+	
+	/// extended address
+	MAC_EXTENDED_ADDR ExtendedAddress;
+	
+	/// queue of received frames
+	CC2420RxFrame RxQueue[CC2420_RX_QUEUE_SIZE];
+	uint8_t RxHead;
+	uint8_t RxCount;
+	
+	/// SFD times of frames in rx fifo
+	uint64_t SFDTimes[CC2420_SFD_QUEUE_SIZE];
+	uint8_t SFDHead;
+	uint8_t SFDCount;
+	
+	#ifdef PHY_LAYER_HANDLE_ACK
+	/// SFD edges in this period of time belong to ACK sent by transceiver
+	uint64_t AckSFDFrom;
+	uint64_t AckSFDTo;
+	#endif
+	
+	/// number of nested SPI transactions
+	uint8_t SPILock;
+	
+	/// rx fifo should be read when SPI transaction ends
+	BOOL RxPending;
 	
 	// data to send
 	uint8_t *TxData;
 	uint8_t TxLen;
 	
+	#ifdef PHY_LAYER_HANDLE_CCA_TX
+	/// CCA and tx request state, it is changed in interrupt
+	CC2420_CCA_TX_STATE CCATxState;
+	
+	/// result of CCA and tx
+	PHY_ENUM CCATxStatus;
+	#endif
+	
 }CC2420DefsStruct;
 static volatile CC2420DefsStruct CC2420Defs;
 
+void CC2420_ReadRxFIFO(void);
+
+/*******************************************************************************//**
+ * begins SPI transaction, rx fifo is not read in interrupt until transaction ends
+ **********************************************************************************/
+void CC2420_BeginTransaction(void)
+{
+	++CC2420Defs.SPILock;
+	SPI_Start(CC2420Defs.SPI);
+}
+
+/*******************************************************************************//**
+ * ends SPI transaction and reads frames received during transaction
+ **********************************************************************************/
+void CC2420_EndTransaction(void)
+{
+	SPI_Stop(CC2420Defs.SPI);
+	
+	BEGIN_CRITICAL_SECTION
+	{
+		--CC2420Defs.SPILock;
+		
+		// if FIFOP interrupt happened during transaction, then read rx fifo
+		if(CC2420Defs.SPILock==0&&CC2420Defs.RxPending)
+		{
+			CC2420Defs.RxPending = FALSE;
+			CC2420_ReadRxFIFO();
+			
+		}
+		
+	}
+	END_CRITICAL_SECTION
+	
+}
+
 /*******************************************************************************//**
  * @implements CC2420_SendCommandStrobe
  **********************************************************************************/
 uint8_t CC2420_SendCommandStrobe(CC2420_COMMAND_STROBE CommandStrobe)
 {
 	uint8_t RxByte;
-	SPI_Start(CC2420Defs.SPI);
+	CC2420_BeginTransaction();
 	SPI_TxRx(CC2420Defs.SPI,CommandStrobe,&RxByte);
-	SPI_Stop(CC2420Defs.SPI);
+	CC2420_EndTransaction();
 	return RxByte;
 }
 
@@ -129,11 +263,13 @@ uint8_t CC2420_SendCommandStrobe(CC2420_COMMAND_STROBE CommandStrobe)
  **********************************************************************************/
 void CC2420_WriteRegister(CC2420_REGISTER Register,uint16_t Value)
 {
-	SPI_Start(CC2420Defs.SPI);
-	SPI_TxRx(CC2420Defs.SPI,Register,NULL);
-	SPI_TxRx(CC2420Defs.SPI,(uint8_t)(Value>>8),NULL);
-	SPI_TxRx(CC2420Defs.SPI,(uint8_t)Value,NULL);
-	SPI_Stop(CC2420Defs.SPI);
+	uint8_t Buf[3];
+	Buf[0] = Register;
+	Buf[1] = (uint8_t)(Value>>8);
+	Buf[2] = (uint8_t)Value;
+	CC2420_BeginTransaction();
+	SPI_TxBuf(CC2420Defs.SPI,3,Buf);
+	CC2420_EndTransaction();
 }
 
 /*******************************************************************************//**
@@ -141,17 +277,320 @@ void CC2420_WriteRegister(CC2420_REGISTER Register,uint16_t Value)
  **********************************************************************************/
 uint16_t CC2420_ReadRegister(CC2420_REGISTER Register)
 {
-	uint16_t Result;
-	uint8_t Value;
-	Register |= (1<<CC2420_READ_WRITE_BIT);
-	SPI_Start(CC2420Defs.SPI);
-	SPI_TxRx(CC2420Defs.SPI,Register,NULL);
-	SPI_TxRx(CC2420Defs.SPI,0,&Value);
-	Result = Value<<8;
-	SPI_TxRx(CC2420Defs.SPI,0,&Value);
-	Result |= Value;
-	SPI_Stop(CC2420Defs.SPI);
-	return Result;
+	uint8_t Buf[3];
+	Buf[0] = Register|(1<<CC2420_READ_WRITE_BIT);
+	Buf[1] = 0;
+	Buf[2] = 0;
+	CC2420_BeginTransaction();
+	SPI_TxRxBuf(CC2420Defs.SPI,3,Buf,Buf);
+	CC2420_EndTransaction();
+	return (((uint16_t)Buf[1])<<8)|Buf[2];
+}
+
+/*******************************************************************************//**
+ * @implements CC2420_WriteRAM
+ **********************************************************************************/
+void CC2420_WriteRAM(uint16_t Address,uint8_t Length,const uint8_t *Data)
+{
+	uint8_t Buf[2];
+	Buf[0] = (1<<CC2420_RAM_REG_BIT)|(Address&0x7F);
+	Buf[1] = (Address>>1)&0xC0;
+	CC2420_BeginTransaction();
+	SPI_TxBuf(CC2420Defs.SPI,2,Buf);
+	SPI_TxBuf(CC2420Defs.SPI,Length,Data);
+	CC2420_EndTransaction();
+}
+
+/*******************************************************************************//**
+ * writes addresses used for address recognition to RAM
+ **********************************************************************************/
+void CC2420_WriteAddress(void)
+{
+	CC2420_WriteRAM(CC2420_RAM_IEEEADR,8,(const uint8_t*)&CC2420Defs.ExtendedAddress);
+	CC2420_WriteRAM(CC2420_RAM_PANID,2,(const uint8_t*)&CC2420Defs.PanID);
+	CC2420_WriteRAM(CC2420_RAM_SHORTADR,2,(const uint8_t*)&CC2420Defs.ShortAddress);
+}
+
+/*******************************************************************************//**
+ * flushes rx fifo and forgets SFD times of frames in it
+ **********************************************************************************/
+void CC2420_FlushRxFIFO(void)
+{
+	// flush twice to make sure that SFD pin goes inactive
+	CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
+	CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
+	
+	CC2420Defs.SFDCount = 0;
+	
+}
+
+/*******************************************************************************//**
+ * flushes tx fifo and writes frame to it
+ * @param[in] Length frame length
+ * @param[in] Data   frame
+ **********************************************************************************/
+void CC2420_WriteTxFIFO(uint8_t Length,uint8_t *Data)
+{
+	uint8_t Header[2];
+	
+	// tx fifo may hold frame which was loaded but not sent
+	CC2420_SendCommandStrobe(CC2420_SFLUSHTX);
+	
+	// write data to tx fifo
+	Header[0] = CC2420_TXFIFO;
+	CC2420_BeginTransaction();
+	
+	#ifdef PHY_LAYER_HANDLE_CHECKSUM
+	Header[1] = Length+2;
+	#else
+	Header[1] = Length;
+	#endif
+	
+	SPI_TxBuf(CC2420Defs.SPI,2,Header);
+	SPI_TxBuf(CC2420Defs.SPI,Length,Data);
+	
+	CC2420_EndTransaction();
+	
+}
+
+#ifdef PHY_LAYER_HANDLE_ACK
+
+/*******************************************************************************//**
+ * checks if SFD edge belongs to ACK sent by transceiver for the last frame read
+ * @param[in] Time time of SFD edge
+ * @return TRUE  if SFD edge belongs to ACK
+ * @return FALSE otherwise
+ **********************************************************************************/
+static BOOL CC2420_IsAckSFD(uint64_t Time)
+{
+	return Time>CC2420Defs.AckSFDFrom&&Time<=CC2420Defs.AckSFDTo;
+}
+
+#endif
+
+#ifdef PHY_LAYER_HANDLE_CCA_TX
+
+/*******************************************************************************//**
+ * performs CCA and starts transmission of tx fifo if channel is idle, must be
+ * called with interrupts disabled when there is no SPI transaction in progress
+ **********************************************************************************/
+void CC2420_TxOnCCA(void)
+{
+	CC2420Defs.CCATxState = CC2420_CCA_TX_DONE;
+	
+	// if TRX is off, then return this state
+	if(CC2420Defs.State<=CC2420_STATE_IDLE)
+	{
+		CC2420Defs.CCATxStatus = PHY_TRX_OFF;
+		
+	}
+	// if tx is on, then return this state
+	else if(CC2420Defs.State>=CC2420_STATE_TX)
+	{
+		CC2420Defs.CCATxStatus = PHY_TX_ON;
+		
+	}
+	// channel is busy while frame is being received
+	else if(CC2420Defs.State==CC2420_STATE_RX_GOT_SFD)
+	{
+		CC2420Defs.CCATxStatus = PHY_BUSY;
+		
+	}
+	// transceiver transmits only if CCA succeeds
+	else
+	{
+		CC2420_STATE State = CC2420Defs.State;
+		
+		// state changes are defered until transmission ends
+		CC2420Defs.State = CC2420_STATE_TX_STARTED;
+		
+		CC2420_SendCommandStrobe(CC2420_STXONCCA);
+		if(CC2420_SendCommandStrobe(CC2420_SNOP)&(1<<CC2420_STATUS_TX_ACTIVE))
+		{
+			CC2420Defs.CCATxStatus = PHY_IDLE;
+			
+		}
+		else
+		{
+			CC2420Defs.State       = State;
+			CC2420Defs.CCATxStatus = PHY_BUSY;
+			
+		}
+		
+	}
+	
+}
+
+#endif
+
+/*******************************************************************************//**
+ * reads all complete frames from rx fifo to the queue of received frames, must be
+ * called with interrupts disabled when there is no SPI transaction in progress
+ **********************************************************************************/
+void CC2420_ReadRxFIFO(void)
+{
+	volatile CC2420RxFrame *Frame;
+	uint8_t Length,LQI;
+	BOOL Received = FALSE;
+	int16_t RSSIVal;
+	#ifndef PHY_LAYER_HANDLE_CHECKSUM
+	uint16_t Val;
+	#endif
+	
+	// frames are not read if receiver is off or all frames are rejected
+	if(CC2420Defs.State<CC2420_STATE_IDLE||
+	   CC2420Defs.State==CC2420_STATE_RX_REJECT_ALL)
+		return;
+	
+	// CC2420 uses system SPI, so guard should idle
+	SAVE_GUARD_STATE
+	Guard_Idle();
+	
+	// FIFOP is active while there is a complete frame in rx fifo
+	while(CC2420_GetFIFOP())
+	{
+		// rx fifo is flushed only if it overflowed
+		if(CC2420_GetRxFIFOOverflow())
+		{
+			CC2420_FlushRxFIFO();
+			break;
+			
+		}
+		
+		// if all frame buffers are busy, then frames stay in rx fifo
+		// until thread handles received frames
+		if(CC2420Defs.RxCount==CC2420_RX_QUEUE_SIZE)
+			break;
+		
+		Frame = &CC2420Defs.RxQueue[(CC2420Defs.RxHead+CC2420Defs.RxCount)%CC2420_RX_QUEUE_SIZE];
+		
+		// get frame length
+		CC2420_BeginTransaction();
+		SPI_TxRx(CC2420Defs.SPI,(CC2420_RXFIFO|(1<<CC2420_READ_WRITE_BIT)),NULL);
+		SPI_TxRx(CC2420Defs.SPI,0,&Length);
+		
+		// if length is wrong, then rx fifo is corrupted
+		if(Length>PHY_A_MAX_PHY_PACKET_SIZE)
+		{
+			CC2420_EndTransaction();
+			CC2420_FlushRxFIFO();
+			break;
+			
+		}
+		
+		// get frame data
+		SPI_RxBuf(CC2420Defs.SPI,Length,(uint8_t*)Frame->Data);
+		
+		CC2420_EndTransaction();
+		
+		// get SFD time of the frame
+		if(CC2420Defs.SFDCount!=0)
+		{
+			Frame->SFDTime = CC2420Defs.SFDTimes[CC2420Defs.SFDHead];
+			CC2420Defs.SFDHead = (CC2420Defs.SFDHead+1)%CC2420_SFD_QUEUE_SIZE;
+			--CC2420Defs.SFDCount;
+			
+		}
+		else
+			Frame->SFDTime = GetTime();
+		
+		#ifdef PHY_LAYER_HANDLE_ACK
+		// transceiver acknowledges frame which requests ACK and has valid CRC,
+		// SFD edge of the ACK is not the SFD of the next frame
+		if(Length>=3&&(Frame->Data[0]&MAC_FCF_ACK_REQUEST)&&
+		   (Frame->Data[Length-1]&(1<<7)))
+		{
+			CC2420Defs.AckSFDFrom = Frame->SFDTime+(uint64_t)(Length+1)*CC2420_BYTE_DURATION;
+			CC2420Defs.AckSFDTo   = CC2420Defs.AckSFDFrom+CC2420_ACK_SFD_WINDOW;
+			
+			// ACK may have been sent before the frame is read
+			if(CC2420Defs.SFDCount!=0&&
+			   CC2420_IsAckSFD(CC2420Defs.SFDTimes[CC2420Defs.SFDHead]))
+			{
+				CC2420Defs.SFDHead = (CC2420Defs.SFDHead+1)%CC2420_SFD_QUEUE_SIZE;
+				--CC2420Defs.SFDCount;
+				
+			}
+			
+		}
+		#endif
+		
+		#ifdef PHY_LAYER_HANDLE_CHECKSUM
+		// skip frames without RSSI and correlation values
+		if(Length<2)
+			continue;
+		
+		// RSSI and correlation values replace FCS
+		Length -= 2;
+		Frame->LQValues = *((uint16_t*)&Frame->Data[Length]);
+		RSSIVal = (int8_t)Frame->Data[Length];
+		LQI     = Frame->Data[Length];
+		#else
+		// skip empty frames
+		if(Length==0)
+			continue;
+		
+		// get RSSI
+		Val     = CC2420_ReadRegister(CC2420_RSSI);
+		RSSIVal = (int8_t)Val;
+		LQI     = (uint8_t)Val;
+		#endif
+		
+		// get LQI
+		if(LQI&0x80)
+			LQI = ~LQI;
+		
+		#ifndef PHY_LAYER_HANDLE_CHECKSUM
+		Frame->LQValues = LQI;
+		#endif
+		
+		// convert RSSI to dBm
+		RSSIVal -= 45;
+		if(RSSIVal<-127)
+			RSSIVal = -127;
+		
+		Frame->Length = Length;
+		Frame->LQI    = LQI;
+		Frame->RSSI   = (int8_t)RSSIVal;
+		
+		++CC2420Defs.RxCount;
+		Received = TRUE;
+		
+	}
+	
+	// if rx fifo is empty and no frame is being received,
+	// then SFD times left belong to discarded frames
+	if(!CC2420_GetFIFO()&&!CC2420_GetSFD())
+		CC2420Defs.SFDCount = 0;
+	
+	// thread should handle received frames
+	if(Received)
+		Thread_Post(CC2420Defs.Thread);
+	
+	RESTORE_GUARD_STATE
+	
+}
+
+/*******************************************************************************//**
+ * seeds random value generator with RSSI noise, receiver must be on. RSSI is
+ * averaged over 8 symbols, so it is read many times to collect several samples
+ **********************************************************************************/
+void CC2420_SeedRandom(void)
+{
+	uint32_t Noise = 0;
+	uint8_t i;
+	
+	// wait for RSSI to become valid
+	for(i=0;i<CC2420_RSSI_VALID_POLLS;++i)
+		if(CC2420_SendCommandStrobe(CC2420_SNOP)&(1<<CC2420_STATUS_RSSI_VALID))
+			break;
+	
+	// low bits of RSSI are noise
+	for(i=0;i<CC2420_NOISE_READS;++i)
+		Noise = ((Noise<<3)|(Noise>>29))^CC2420_ReadRegister(CC2420_RSSI);
+	
+	Utils_Seed(Noise);
+	
 }
 
 /*******************************************************************************//**
@@ -161,9 +600,12 @@ void CC2420_Configure(void)
 {
 	uint16_t Val;
 	
-	// disable hardware MAC operations
+	// configure hardware MAC operations
 	Val = CC2420_ReadRegister(CC2420_MDMCTRL0);
-	#ifdef PHY_LAYER_HANDLE_CHECKSUM
+	#if defined(PHY_LAYER_HANDLE_ACK)
+	Val &= ~(1<<CC2420_MDMCTRL0_PAN_COORDINATOR);
+	Val |=  (1<<CC2420_MDMCTRL0_ADR_DECODE)|(1<<CC2420_MDMCTRL0_AUTOCRC)|(1<<CC2420_MDMCTRL0_AUTOACK);
+	#elif defined(PHY_LAYER_HANDLE_CHECKSUM)
 	Val &= ~((1<<CC2420_MDMCTRL0_PAN_COORDINATOR)|(1<<CC2420_MDMCTRL0_ADR_DECODE)|(1<<CC2420_MDMCTRL0_AUTOACK));
 	Val |=  (1<<CC2420_MDMCTRL0_AUTOCRC);
 	#else
@@ -171,6 +613,9 @@ void CC2420_Configure(void)
 	#endif
 	CC2420_WriteRegister(CC2420_MDMCTRL0,Val);
 	
+	// set addresses for address recognition
+	CC2420_WriteAddress();
+	
 	// disable hardware security operations
 	Val = CC2420_ReadRegister(CC2420_SECCTRL0);
 	Val &= ~((1<<CC2420_SECCTRL0_RXFIFO_PROTECTION)|(1<<CC2420_SECCTRL0_SEC_MODE_1)|(1<<CC2420_SECCTRL0_SEC_MODE_0));
@@ -194,6 +639,9 @@ EVENT CC2420_TimerFired(PARAM Param)
 		// change state to power down with vreg on
 		CC2420Defs.State = CC2420_STATE_POWER_DOWN;
 		
+		// thread should switch on osc
+		Thread_Post(CC2420Defs.Thread);
+		
 	}
 	// if current state is waiting for vreg to be turned off
 	else if(CC2420Defs.State==CC2420_STATE_VREG_WAITING_OFF)
@@ -214,8 +662,8 @@ EVENT CC2420_TimerFired(PARAM Param)
 PROC CC2420_ThreadProc(PARAM Param)
 {
 	uint16_t Val;
-	uint8_t i,LQI,Byte;
 	int8_t RSSIVal;
+	volatile CC2420RxFrame *Frame;
 	
 	// request data
 	if(CC2420_OPERATION_IS(PHY_OPERATION_REQUEST_DATA))
@@ -239,43 +687,11 @@ PROC CC2420_ThreadProc(PARAM Param)
 		// everithing is fine, send data
 		else
 		{
-			// if there was tx underflow, then flush tx fifo
-			if(CC2420_SendCommandStrobe(CC2420_SNOP)&(1<<CC2420_STATUS_TX_UNDERFLOW))
-			{
-				// flush tx buffer
-				CC2420_SendCommandStrobe(CC2420_SFLUSHTX);
-				
-			}
-			
 			// write data to tx fifo
-			SPI_Start(CC2420Defs.SPI);
-			
-			SPI_TxRx(CC2420Defs.SPI,CC2420_TXFIFO,NULL);
-			
-			#ifdef PHY_LAYER_HANDLE_CHECKSUM
-			SPI_TxRx(CC2420Defs.SPI,CC2420Defs.TxLen+2,&Byte);
-			#else
-			SPI_TxRx(CC2420Defs.SPI,CC2420Defs.TxLen,&Byte);
-			#endif
-			
-			for(i=0;i<CC2420Defs.TxLen;++i)
-			{
-				SPI_TxRx(CC2420Defs.SPI,CC2420Defs.TxData[i],NULL);
-				
-			}
-			
-			SPI_Stop(CC2420Defs.SPI);
+			CC2420_WriteTxFIFO(CC2420Defs.TxLen,CC2420Defs.TxData);
 			
-			// if there was rx fifo overflow, then flush rx fifo twice
-			if(CC2420_GetRxFIFOOverflow())
-			{
-				CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
-				CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
-				
-			}
-			
-			// begin transmission
-			CC2420Defs.State = CC2420_STATE_TX;
+			// begin transmission, state changes are defered until it ends
+			CC2420Defs.State = CC2420_STATE_TX_STARTED;
 			
 			CC2420_SendCommandStrobe(CC2420_STXON);
 			
@@ -295,8 +711,7 @@ PROC CC2420_ThreadProc(PARAM Param)
 			
 		}
 		// if tx is on, then return this state
-		else if(CC2420Defs.State==CC2420_STATE_TX||
-		        CC2420Defs.State==CC2420_STATE_TX_GOT_SFD)
+		else if(CC2420Defs.State>=CC2420_STATE_TX)
 		{
 			SIGNAL_EVENT(PHYLayer_CCA_Confirm(PHY_TX_ON))
 			
@@ -315,6 +730,25 @@ PROC CC2420_ThreadProc(PARAM Param)
 		
 	}
 	
+	#ifdef PHY_LAYER_HANDLE_CCA_TX
+	// request CCA and tx
+	if(CC2420Defs.CCATxState!=CC2420_CCA_TX_NONE)
+	{
+		BEGIN_CRITICAL_SECTION
+		{
+			// it was not done in interrupt because of SPI transaction
+			if(CC2420Defs.CCATxState==CC2420_CCA_TX_REQUESTED)
+				CC2420_TxOnCCA();
+			
+			CC2420Defs.CCATxState = CC2420_CCA_TX_NONE;
+		}
+		END_CRITICAL_SECTION
+		
+		SIGNAL_EVENT(PHYLayer_CCA_Confirm(CC2420Defs.CCATxStatus))
+		
+	}
+	#endif
+	
 	// request ED
 	if(CC2420_OPERATION_IS(PHY_OPERATION_ED))
 	{
@@ -327,8 +761,7 @@ PROC CC2420_ThreadProc(PARAM Param)
 			
 		}
 		// if tx is on, then return this state
-		else if(CC2420Defs.State==CC2420_STATE_TX||
-		        CC2420Defs.State==CC2420_STATE_TX_GOT_SFD)
+		else if(CC2420Defs.State>=CC2420_STATE_TX)
 		{
 			SIGNAL_EVENT(PHYLayer_ED_Confirm(PHY_TX_ON,0))
 			
@@ -369,7 +802,8 @@ PROC CC2420_ThreadProc(PARAM Param)
 					
 				}
 				// it is transmitting packet
-				else if(CC2420Defs.State==CC2420_STATE_TX_GOT_SFD)
+				else if(CC2420Defs.State==CC2420_STATE_TX_GOT_SFD||
+				        CC2420Defs.State==CC2420_STATE_TX_STARTED)
 				{
 					CC2420_DEFER_OPERATION
 					SIGNAL_EVENT(PHYLayer_SETTRXSTATE_Confirm(PHY_BUSY_TX))
@@ -394,7 +828,8 @@ PROC CC2420_ThreadProc(PARAM Param)
 					
 				}
 				// it is transmitting packet
-				else if(CC2420Defs.State==CC2420_STATE_TX_GOT_SFD)
+				else if(CC2420Defs.State==CC2420_STATE_TX_GOT_SFD||
+				        CC2420Defs.State==CC2420_STATE_TX_STARTED)
 				{
 					CC2420_DEFER_OPERATION
 					SIGNAL_EVENT(PHYLayer_SETTRXSTATE_Confirm(PHY_BUSY_TX))
@@ -413,8 +848,7 @@ PROC CC2420_ThreadProc(PARAM Param)
 			// tx on
 			case PHY_TX_ON:
 				// it is altready in this state
-				if(CC2420Defs.State==CC2420_STATE_TX||
-				   CC2420Defs.State==CC2420_STATE_TX_GOT_SFD)
+				if(CC2420Defs.State>=CC2420_STATE_TX)
 				{
 					SIGNAL_EVENT(PHYLayer_SETTRXSTATE_Confirm(PHY_TX_ON))
 					
@@ -452,7 +886,8 @@ PROC CC2420_ThreadProc(PARAM Param)
 					
 				}
 				// it is transmitting packet
-				else if(CC2420Defs.State==CC2420_STATE_TX_GOT_SFD)
+				else if(CC2420Defs.State==CC2420_STATE_TX_GOT_SFD||
+				        CC2420Defs.State==CC2420_STATE_TX_STARTED)
 				{
 					CC2420_DEFER_OPERATION
 					SIGNAL_EVENT(PHYLayer_SETTRXSTATE_Confirm(PHY_BUSY_TX))
@@ -594,6 +1029,34 @@ PROC CC2420_ThreadProc(PARAM Param)
 		
 	}
 	
+	// handle received frames
+	while(CC2420Defs.RxCount!=0)
+	{
+		Frame = &CC2420Defs.RxQueue[CC2420Defs.RxHead];
+		
+		// parameters of the frame are available during data indication
+		CC2420Defs.LastSFDTime = Frame->SFDTime;
+		CC2420Defs.LastRSSI    = Frame->RSSI;
+		CC2420Defs.LQValues    = Frame->LQValues;
+		
+		// signal data indication
+		SIGNAL_EVENT(PHYLayer_DATA_Indication(Frame->Length,(uint8_t*)Frame->Data,Frame->LQI))
+		
+		BEGIN_CRITICAL_SECTION
+		{
+			// free frame buffer
+			CC2420Defs.RxHead = (CC2420Defs.RxHead+1)%CC2420_RX_QUEUE_SIZE;
+			--CC2420Defs.RxCount;
+			
+			// read frames which stayed in rx fifo because there was no free buffer
+			if(CC2420Defs.SPILock==0)
+				CC2420_ReadRxFIFO();
+			
+		}
+		END_CRITICAL_SECTION
+		
+	}
+	
 	// handle radio states
 	switch(CC2420Defs.State)
 	{
@@ -627,6 +1090,9 @@ PROC CC2420_ThreadProc(PARAM Param)
 			CC2420_WriteRegister(CC2420_FSCTRL,Val);
 			CC2420_SendCommandStrobe(CC2420_SRXON);
 			
+			// nodes must not share backoff sequences
+			CC2420_SeedRandom();
+			
 			// change state
 			CC2420Defs.State = CC2420_STATE_IDLE;
 			
@@ -636,63 +1102,10 @@ PROC CC2420_ThreadProc(PARAM Param)
 			break;
 		
 		// receiving
-		case CC2420_STATE_RX_READING:
-			// get data from rx fifo
-			SPI_Start(CC2420Defs.SPI);
-			
-			SPI_TxRx(CC2420Defs.SPI,(CC2420_RXFIFO|(1<<CC2420_READ_WRITE_BIT)),NULL);
-			
-			SPI_TxRx(CC2420Defs.SPI,0,&Byte);
-			CC2420Defs.RxLen = Byte;
-			
-			// check data length
-			if(CC2420Defs.RxLen>PHY_A_MAX_PHY_PACKET_SIZE)
-			{
-				SPI_Stop(CC2420Defs.SPI);
-				
-				// if length is wrong, then flush the RXFIFO
-				CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
-				CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
-				
-				// exit
+		case CC2420_STATE_RX_GOT_SFD:
+			// wait for the end of frame
+			if(CC2420_GetSFD())
 				break;
-			}
-			
-			// get data
-			for(i=0;i<CC2420Defs.RxLen;++i)
-			{
-				SPI_TxRx(CC2420Defs.SPI,0,&Byte);
-				CC2420Defs.RxData[i] = Byte;
-			}
-			
-			SPI_Stop(CC2420Defs.SPI);
-			
-			if(CC2420Defs.RxLen!=0)
-			{
-				
-				#ifdef PHY_LAYER_HANDLE_CHECKSUM
-				// get LQI
-				LQI = CC2420Defs.RxData[CC2420Defs.RxLen-2];
-				if(LQI&0x80)
-					LQI = ~LQI;
-				CC2420Defs.RxLen -= 2;
-				CC2420Defs.LQValues = *((uint16_t*)&CC2420Defs.RxData[CC2420Defs.RxLen]);
-				#else
-				// get LQI
-				LQI = (uint8_t)CC2420_ReadRegister(CC2420_RSSI);
-				if(LQI&0x80)
-					LQI = ~LQI;
-				CC2420Defs.LQValues = LQI;
-				#endif
-				
-				// signal data indication
-				SIGNAL_EVENT(PHYLayer_DATA_Indication(CC2420Defs.RxLen,(uint8_t*)CC2420Defs.RxData,LQI))
-				
-			}
-			
-			// flush rx fifo
-			CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
-			CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
 			
 			// change state
 			CC2420Defs.State = CC2420_STATE_RX;
@@ -726,8 +1139,7 @@ PROC CC2420_ThreadProc(PARAM Param)
 		// receiving and rejecting all frames
 		case CC2420_STATE_RX_REJECT_ALL:
 			// flush RXFIFO
-			CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
-			CC2420_SendCommandStrobe(CC2420_SFLUSHRX);
+			CC2420_FlushRxFIFO();
 			break;
 		
 		// transmitting
@@ -735,8 +1147,21 @@ PROC CC2420_ThreadProc(PARAM Param)
 			if(CC2420_SendCommandStrobe(CC2420_SNOP)&(1<<CC2420_STATUS_TX_ACTIVE))
 				break;
 			
-			CC2420_SendCommandStrobe(CC2420_SRFOFF);
-			CC2420Defs.State = CC2420_STATE_TX;
+			// transceiver returns to rx by itself when transmission ends,
+			// so it is ready for ACK frame if rx on state was defered
+			if(CC2420_OPERATION_IS(PHY_OPERATION_DEFERED)&&
+			   CC2420Defs.NewTRXState==PHY_RX_ON)
+			{
+				CC2420_STOP_OPERATION(PHY_OPERATION_DEFERED)
+				CC2420Defs.State = CC2420_STATE_RX;
+				
+			}
+			else
+			{
+				CC2420_SendCommandStrobe(CC2420_SRFOFF);
+				CC2420Defs.State = CC2420_STATE_TX;
+				
+			}
 			
 			// if there is defered state change then change the state
 			if(CC2420_OPERATION_IS(PHY_OPERATION_DEFERED))
@@ -776,6 +1201,11 @@ PROC CC2420_ThreadProc(PARAM Param)
 		
 	}
 	
+	// these states are polled, so thread should run again
+	if(CC2420Defs.State==CC2420_STATE_OSC_ENABLE_WAITING||
+	   CC2420Defs.State==CC2420_STATE_TX_GOT_SFD)
+		Thread_Post(CC2420Defs.Thread);
+	
 }
 
 /*******************************************************************************//**
@@ -825,6 +1255,9 @@ RESULT Radio_SetState(RADIO_TRANSCEIVER_STATE State)
 		// disable voltage regulator
 		CC2420_VRegSwitchOff();
 		
+		// rx fifo is lost
+		CC2420Defs.SFDCount = 0;
+		
 		// change state
 		CC2420Defs.State = CC2420_STATE_VREG_WAITING_OFF;
 		
@@ -873,6 +1306,9 @@ void Radio_PowerSave(void)
 	// disable voltage regulator
 	CC2420_VRegSwitchOff();
 	
+	// rx fifo is lost
+	CC2420Defs.SFDCount = 0;
+	
 }
 
 /*******************************************************************************//**
@@ -933,12 +1369,33 @@ RESULT PHYLayer_Init(void)
 	CC2420Defs.NewTRXState = PHY_SUCCESS;
 	CC2420Defs.LQValues    = 0;
 	
+	CC2420Defs.LastRSSI    = 0;
+	
 	CC2420Defs.TxData = NULL;
 	CC2420Defs.TxLen  = 0;
-	CC2420Defs.RxLen  = 0;
+	
+	#ifdef PHY_LAYER_HANDLE_CCA_TX
+	CC2420Defs.CCATxState  = CC2420_CCA_TX_NONE;
+	CC2420Defs.CCATxStatus = PHY_BUSY;
+	#endif
+	
+	CC2420Defs.PanID           = DEFAULT_PAN_ID;
+	CC2420Defs.ShortAddress    = 0xFFFF;
+	CC2420Defs.ExtendedAddress = MAC_DEFAULT_A_EXTENDED_ADDRESS;
+	
+	CC2420Defs.RxHead    = 0;
+	CC2420Defs.RxCount   = 0;
+	CC2420Defs.SFDHead   = 0;
+	CC2420Defs.SFDCount  = 0;
+	#ifdef PHY_LAYER_HANDLE_ACK
+	CC2420Defs.AckSFDFrom = 0;
+	CC2420Defs.AckSFDTo   = 0;
+	#endif
+	CC2420Defs.SPILock   = 0;
+	CC2420Defs.RxPending = FALSE;
 	
 	// init SPI interface
-	CC2420Defs.SPI = SPI_Open(CC2420_SPI_CHANNEL,SPI_MODE_MASTER|SPI_TRANSMISSION_MODE_SYNC,NULL);
+	CC2420Defs.SPI = SPI_Open(CC2420_SPI_CHANNEL,SPI_MODE_MASTER|SPI_TRANSMISSION_MODE_SYNC|SPI_SPEED_DOUBLE,NULL);
 	if(IS_INVALID_HANDLE(CC2420Defs.SPI))
 		return FAIL;
 	
@@ -953,7 +1410,7 @@ RESULT PHYLayer_Init(void)
 		return FAIL;
 	
 	// start thread
-	if(Thread_Start(CC2420Defs.Thread,THREAD_PROCESS_MODE)==FAIL)
+	if(Thread_Start(CC2420Defs.Thread,THREAD_EVENT_MODE|THREAD_PRIORITY_HIGHEST)==FAIL)
 		return FAIL;
 	
 	// return success
@@ -974,6 +1431,7 @@ RESULT PHYLayer_DATA_Request(uint8_t Length,uint8_t *Data)
 	CC2420Defs.TxData = Data;
 	CC2420Defs.TxLen  = Length;
 	CC2420Defs.Operation |= 1<<PHY_OPERATION_REQUEST_DATA;
+	Thread_Post(CC2420Defs.Thread);
 	
 	// return success
 	return SUCCESS;
@@ -989,11 +1447,65 @@ RESULT PHYLayer_CCA_Request(void)
 		return FAIL;
 	
 	CC2420Defs.Operation |= 1<<PHY_OPERATION_CCA;
+	Thread_Post(CC2420Defs.Thread);
 	
 	// return success
 	return SUCCESS;
 }
 
+#ifdef PHY_LAYER_HANDLE_CCA_TX
+
+/*******************************************************************************//**
+ * @implements PHYLayer_LoadTx
+ **********************************************************************************/
+RESULT PHYLayer_LoadTx(uint8_t Length,uint8_t *Data)
+{
+	// check CC2420 state
+	if(CC2420Defs.State<CC2420_STATE_IDLE)
+		return FAIL;
+	
+	if(Data==NULL||Length==0)
+		return FAIL;
+	
+	// tx fifo can not be changed during transmission
+	if(CC2420Defs.State==CC2420_STATE_TX_STARTED||
+	   CC2420Defs.State==CC2420_STATE_TX_GOT_SFD)
+		return FAIL;
+	
+	CC2420_WriteTxFIFO(Length,Data);
+	
+	// return success
+	return SUCCESS;
+}
+
+/*******************************************************************************//**
+ * @implements PHYLayer_CCATX_Request
+ **********************************************************************************/
+RESULT PHYLayer_CCATX_Request(void)
+{
+	// check CC2420 state
+	if(CC2420Defs.State<CC2420_STATE_IDLE)
+		return FAIL;
+	
+	BEGIN_CRITICAL_SECTION
+	{
+		CC2420Defs.CCATxState = CC2420_CCA_TX_REQUESTED;
+		
+		// CCA and tx are done right now, unless SPI transaction is in progress
+		if(CC2420Defs.SPILock==0)
+			CC2420_TxOnCCA();
+		
+	}
+	END_CRITICAL_SECTION
+	
+	Thread_Post(CC2420Defs.Thread);
+	
+	// return success
+	return SUCCESS;
+}
+
+#endif
+
 /*******************************************************************************//**
  * @implements PHYLayer_ED_Request
  **********************************************************************************/
@@ -1004,6 +1516,7 @@ RESULT PHYLayer_ED_Request(void)
 		return FAIL;
 	
 	CC2420Defs.Operation |= 1<<PHY_OPERATION_ED;
+	Thread_Post(CC2420Defs.Thread);
 	
 	// return success
 	return SUCCESS;
@@ -1020,6 +1533,7 @@ RESULT PHYLayer_GET_Request(PHY_PIB_ATTRIBUTE_PARAM PIBAttribute)
 	
 	CC2420Defs.GetPIBAttribute = PIBAttribute;
 	CC2420Defs.Operation |= 1<<PHY_OPERATION_GET;
+	Thread_Post(CC2420Defs.Thread);
 	
 	// return success
 	return SUCCESS;
@@ -1036,6 +1550,7 @@ RESULT PHYLayer_SETTRXSTATE_Request(PHY_ENUM State)
 	
 	CC2420Defs.NewTRXState = State;
 	CC2420Defs.Operation |= 1<<PHY_OPERATION_SET_TRX_STATE;
+	Thread_Post(CC2420Defs.Thread);
 	
 	// return success
 	return SUCCESS;
@@ -1090,34 +1605,81 @@ RESULT PHYLayer_SET_Request(PHY_PIB_ATTRIBUTE_PARAM PIBAttribute,
 		
 	}
 	
+	Thread_Post(CC2420Defs.Thread);
+	
 	// return success
 	return SUCCESS;
 }
 
 /*******************************************************************************//**
- * @implements CC2420_SFDReceived
+ * @implements PHYLayer_GetLastSFDTime
  **********************************************************************************/
 uint64_t PHYLayer_GetLastSFDTime(void)
 {
 	return CC2420Defs.LastSFDTime;
 }
 
+/*******************************************************************************//**
+ * @implements PHYLayer_GetLastRSSI
+ **********************************************************************************/
+int8_t PHYLayer_GetLastRSSI(void)
+{
+	return CC2420Defs.LastRSSI;
+}
+
+/*******************************************************************************//**
+ * @implements PHYLayer_SetAddress
+ **********************************************************************************/
+void PHYLayer_SetAddress(uint16_t PanID,MAC_SHORT_ADDR ShortAddress,
+                         MAC_EXTENDED_ADDR ExtendedAddress)
+{
+	CC2420Defs.PanID           = PanID;
+	CC2420Defs.ShortAddress    = ShortAddress;
+	CC2420Defs.ExtendedAddress = ExtendedAddress;
+	
+	// RAM is written when oscillator starts, if it is not running
+	if(CC2420Defs.State>=CC2420_STATE_IDLE)
+		CC2420_WriteAddress();
+	
+}
+
 /*******************************************************************************//**
  * @implements CC2420_SFDReceived
  **********************************************************************************/
 EVENT CC2420_SFDReceived(void)
 {
-	if(CC2420Defs.State==CC2420_STATE_RX)
+	if(CC2420Defs.State==CC2420_STATE_RX||
+	   CC2420Defs.State==CC2420_STATE_RX_GOT_SFD)
 	{
-		CC2420Defs.LastSFDTime = GetTime();
+		#ifdef PHY_LAYER_HANDLE_ACK
+		// ACK is sent for frame which is already read, it is not a new frame
+		if(CC2420_IsAckSFD(GetTime()))
+			return;
+		#endif
+		
+		// if there is no room for SFD time, then forget the oldest one
+		if(CC2420Defs.SFDCount==CC2420_SFD_QUEUE_SIZE)
+		{
+			CC2420Defs.SFDHead = (CC2420Defs.SFDHead+1)%CC2420_SFD_QUEUE_SIZE;
+			--CC2420Defs.SFDCount;
+			
+		}
+		
+		// save SFD time of the frame being received
+		CC2420Defs.SFDTimes[(CC2420Defs.SFDHead+CC2420Defs.SFDCount)%CC2420_SFD_QUEUE_SIZE] = GetTime();
+		++CC2420Defs.SFDCount;
+		
 		CC2420Defs.State = CC2420_STATE_RX_GOT_SFD;
 		
 	}
-	else if(CC2420Defs.State==CC2420_STATE_TX)
+	else if(CC2420Defs.State==CC2420_STATE_TX_STARTED)
 	{
 		CC2420Defs.LastSFDTime = GetTime();
 		CC2420Defs.State = CC2420_STATE_TX_GOT_SFD;
 		
+		// thread should wait for the end of transmission
+		Thread_Post(CC2420Defs.Thread);
+		
 	}
 	
 }
@@ -1127,10 +1689,23 @@ EVENT CC2420_SFDReceived(void)
  **********************************************************************************/
 EVENT CC2420_FIFOPReceived(void)
 {
-	// check current state
-	if(CC2420Defs.State!=CC2420_STATE_RX_GOT_SFD)
+	// if all frames are rejected, then thread should flush rx fifo
+	if(CC2420Defs.State==CC2420_STATE_RX_REJECT_ALL)
+	{
+		Thread_Post(CC2420Defs.Thread);
+		return;
+		
+	}
+	
+	// if SPI transaction is in progress, then frames are read when it ends
+	if(CC2420Defs.SPILock!=0)
+	{
+		CC2420Defs.RxPending = TRUE;
 		return;
+		
+	}
 	
-	CC2420Defs.State = CC2420_STATE_RX_READING;
+	// read all complete frames
+	CC2420_ReadRxFIFO();
 	
 }
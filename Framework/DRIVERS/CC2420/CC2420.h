@@ -55,6 +55,14 @@ typedef enum
 	CC2420_RXFIFO   = 0x3F
 }CC2420_REGISTER;
 
+/// CC2420 RAM addresses
+enum
+{
+	CC2420_RAM_IEEEADR  = 0x160,
+	CC2420_RAM_PANID    = 0x168,
+	CC2420_RAM_SHORTADR = 0x16A
+};
+
 /// CC2420 MDMCTRL0 register bits
 enum
 {
@@ -95,6 +103,14 @@ void CC2420_WriteRegister(CC2420_REGISTER Register,uint16_t Value);
  **********************************************************************************/
 uint16_t CC2420_ReadRegister(CC2420_REGISTER Register);
 
+/*******************************************************************************//**
+ * writes data to RAM, crystal oscillator must be running
+ * @param[in] Address RAM address
+ * @param[in] Length  data length
+ * @param[in] Data    data
+ **********************************************************************************/
+void CC2420_WriteRAM(uint16_t Address,uint8_t Length,const uint8_t *Data);
+
 /*******************************************************************************//**
  * inits CC2420
  * @return SUCCESS if CC2420 successfully initialised
@@ -135,6 +151,12 @@ BOOL CC2420_GetRxFIFOOverflow(void);
  **********************************************************************************/
 uint8_t CC2420_GetFIFO(void);
 
+/*******************************************************************************//**
+ * returns state of FIFOP pin
+ * @return state of FIFOP pin
+ **********************************************************************************/
+uint8_t CC2420_GetFIFOP(void);
+
 /*******************************************************************************//**
  * returns state of CCA pin
  * @return state of CCA pin
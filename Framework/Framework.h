@@ -14,6 +14,7 @@
 #include "API/CommonAPI.h"
 #include "API/TimersAPI.h"
 #include "API/UARTAPI.h"
+#include "API/PWRAPI.h"
 #include "API/LEDsAPI.h"
 #include "API/SPIAPI.h"
 #include "API/TWIAPI.h"
@@ -6,6 +6,7 @@
  
 #include "../../PIL/Scheduler/Scheduler.h"
 #include "../../PIL/Buttons/Buttons.h"
+#include "../../PIL/Timers/Timers.h"
 #include "../../API/ButtonsAPI.h"
 #include "../../API/CommonAPI.h"
 #include "../../PIL/Guard.h"
@@ -17,6 +18,8 @@
 #define BTN1 (1<<5)
 #define BTN2 (1<<6)
 
+#define BUTTONS_POLLING_PERIOD 20
+
 #define BUTTONS_ARE_SYSTEM_BUTTONS    ((ButtonsDefs.Status)&1)
 #define BUTTONS_SET_SYS_ACCESS_RIGHTS {ButtonsDefs.Status |=  1;}
 #define BUTTONS_SET_APP_ACCESS_RIGHTS {ButtonsDefs.Status &= ~1;}
@@ -25,12 +28,20 @@
 #define BUTTONS_CLOSE  {ButtonsDefs.Status &= ~2;}
 #define BUTTONS_OPEN   {ButtonsDefs.Status |=  2;}
 
+// this module needs Timers
+#ifndef USE_TIMERS
+#error Timers needed but not used
+#endif
+
 // structure defines buttons
 typedef struct
 {
 	/// thread handle
 	HThread Thread;
 	
+	/// polling timer handle
+	HTimer Timer;
+	
 	/// status of buttons
 	uint8_t Status;
 	
@@ -46,6 +57,16 @@ typedef struct
 }ButtonsDefsStruct;
 static volatile ButtonsDefsStruct ButtonsDefs;
 
+/*******************************************************************************//**
+ * buttons timer "fired" event
+ **********************************************************************************/
+EVENT Buttons_TimerFired(PARAM Param)
+{
+	// thread should check the buttons
+	Thread_Post(ButtonsDefs.Thread);
+	
+}
+
 /*******************************************************************************//**
  * buttons thread proc
  **********************************************************************************/
@@ -101,6 +122,7 @@ PROC Buttons_ThreadProc(PARAM Param)
 RESULT Buttons_Init(void)
 {
 	ButtonsDefs.Thread = INVALID_HANDLE;
+	ButtonsDefs.Timer  = INVALID_HANDLE;
 	ButtonsDefs.Status = 0;
 	ButtonsDefs.State  = 0;
 	ButtonsDefs.Pressed  = NULL;
@@ -112,7 +134,12 @@ RESULT Buttons_Init(void)
 		return FAIL;
 	
 	// start thread
-	if(Thread_Start(ButtonsDefs.Thread,THREAD_PROCESS_MODE)==FAIL)
+	if(Thread_Start(ButtonsDefs.Thread,THREAD_EVENT_MODE|THREAD_PRIORITY_NORMAL)==FAIL)
+		return FAIL;
+	
+	// create timer
+	ButtonsDefs.Timer = Timer_Create(Buttons_TimerFired,NULL);
+	if(IS_INVALID_HANDLE(ButtonsDefs.Timer))
 		return FAIL;
 	
 	return SUCCESS;
@@ -159,6 +186,18 @@ RESULT Buttons_Open(EVENT (*Pressed)(uint8_t Buttons),
 	else
 		BUTTONS_SET_APP_ACCESS_RIGHTS
 	
+	// save current guard state
+	SAVE_GUARD_STATE
+	
+	// this is a system block of code, so guard may idle
+	Guard_Idle();
+	
+	// start polling the buttons
+	Timer_Start(ButtonsDefs.Timer,TIMER_CYCLIC_MODE|TIMER_INTERRUPT_MODE,MS(BUTTONS_POLLING_PERIOD));
+	
+	// restore previous guard state
+	RESTORE_GUARD_STATE
+	
 	return SUCCESS;
 }
 
@@ -175,6 +214,18 @@ RESULT Buttons_Close(void)
 	// close buttons
 	BUTTONS_CLOSE
 	
+	// save current guard state
+	SAVE_GUARD_STATE
+	
+	// this is a system block of code, so guard may idle
+	Guard_Idle();
+	
+	// stop polling the buttons
+	Timer_Stop(ButtonsDefs.Timer);
+	
+	// restore previous guard state
+	RESTORE_GUARD_STATE
+	
 	ButtonsDefs.Pressed  = NULL;
 	ButtonsDefs.Released = NULL;
 	
@@ -115,6 +115,14 @@ inline uint8_t CC2420_GetFIFO(void)
 	return (CC2420_FIFO_PIN&(1<<CC2420_FIFO));
 }
 
+/*******************************************************************************//**
+ * @implements CC2420_GetFIFOP
+ **********************************************************************************/
+inline uint8_t CC2420_GetFIFOP(void)
+{
+	return (CC2420_FIFOP_PIN&(1<<CC2420_FIFOP));
+}
+
 /*******************************************************************************//**
  * @implements CC2420_GetCCA
  **********************************************************************************/
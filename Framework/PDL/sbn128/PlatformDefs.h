@@ -30,11 +30,30 @@
 /// PHY layer shall handle CRC
 #define PHY_LAYER_HANDLE_CHECKSUM
 
+/// PHY layer shall filter frames by address and send ACK frames,
+/// transceiver can not decode legacy MAC headers
+#ifndef MAC_LAYER_LEGACY_ADDRESSING
+#define PHY_LAYER_HANDLE_ACK
+#endif
+
+/// PHY layer shall perform CCA and start transmission at once
+#define PHY_LAYER_HANDLE_CCA_TX
+
 /// spi channel for CC2420
 #ifndef CC2420_SPI_CHANNEL
 #define CC2420_SPI_CHANNEL 0
 #endif
 
+/// number of received frames CC2420 can hold before they are handled
+#ifndef CC2420_RX_QUEUE_SIZE
+#define CC2420_RX_QUEUE_SIZE 2
+#endif
+
+/// number of SFD times CC2420 can hold for frames in RXFIFO
+#ifndef CC2420_SFD_QUEUE_SIZE
+#define CC2420_SFD_QUEUE_SIZE 4
+#endif
+
 #define SHT11_TWI_CHANNEL 0
 
 #define NUM_SENSORS 2
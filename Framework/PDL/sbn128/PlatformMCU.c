@@ -4,6 +4,7 @@
  * @author Nezametdinov I.E.
  */
 
+#include "../../PIL/Scheduler/Scheduler.h"
 #include "../../PIL/MCU/MCU.h"
 #include <avr/interrupt.h>
 #include <avr/io.h>
@@ -67,34 +68,35 @@ void PowerSaveTimer_Stop(void)
  **********************************************************************************/
 void PowerSaveTimer_Configure(TIME Interval)
 {
-	// change compare register of the timer
+	// change compare register of the timer, in CTC mode interrupt happens
+	// every OCR0+1 ticks of 31250 micro seconds
 	if(Interval<500000)
 	{
-		OCR0 = 1;
+		OCR0 = 0;
 		TicksPerInterrupt = 31250;
 		while(ASSR & (1<<OCR0UB));
 	}
 	else if(Interval<1000000)
 	{
-		OCR0 = 16;
+		OCR0 = 15;
 		TicksPerInterrupt = 500000;
 		while(ASSR & (1<<OCR0UB));
 	}
 	else if(Interval<4000000)
 	{
-		OCR0 = 32;
+		OCR0 = 31;
 		TicksPerInterrupt = 1000000;
 		while(ASSR & (1<<OCR0UB));
 	}
 	else if(Interval<7968750)
 	{
-		OCR0 = 128;
+		OCR0 = 127;
 		TicksPerInterrupt = 4000000;
 		while(ASSR & (1<<OCR0UB));
 	}
 	else
 	{
-		OCR0 = 255;
+		OCR0 = 254;
 		TicksPerInterrupt = 7968750;
 		while(ASSR & (1<<OCR0UB));
 	}
@@ -159,14 +161,37 @@ void MCU_PowerSave(void)
 	MCUCR &= ~((1<<SM2)|(1<<SM1)|(1<<SM0));
 	MCUCR |= (1<<SM1)|(1<<SM0);
 	
-	// enter power save mode
-	while(PowerSave)
+	// enter power save mode until power save timer expires or some interrupt
+	// posts a thread, ready queue is checked with interrupts disabled and sleep
+	// follows sei immediately, so thread can not be posted unnoticed
+	while(TRUE)
 	{
+		cli();
+		if(!PowerSave||!Scheduler_IsIdle())
+			break;
+		
 		MCUCR |= (1<<SE);
-		__asm__ __volatile__ ("sleep" "\n\t" :: );
+		__asm__ __volatile__ ("sei" "\n\t" "sleep" "\n\t" :: );
 		MCUCR &= ~(1<<SE);
 	}
 	
+	// if MCU is woken up before deadline
+	if(PowerSave)
+	{
+		// stop timer, counter is valid after update of control register
+		TIMSK &= ~(1<<OCIE0);
+		TCCR0 &= ~((1<<CS02) | (1<<CS01) | (1<<CS00));
+		while(ASSR & (1<<TCR0UB));
+		
+		// power save period is the time really elapsed, it includes
+		// ticks of 31250 micro seconds counted after the last interrupt
+		PowerSavePeriod -= TimeLeft;
+		PowerSavePeriod += (TIME)TCNT0*31250;
+		PowerSave = FALSE;
+		
+	}
+	sei();
+	
 	// stop power save timer
 	PowerSaveTimer_Stop();
 }
@@ -17,7 +17,9 @@
 RESULT MCU_Init(void);
 
 /*******************************************************************************//**
- * forces MCU to enter power save mode
+ * forces MCU to enter power save mode, it is left when power save period ends
+ * or when ready queue of scheduler is not empty, then power save period is set
+ * to the time really elapsed
  **********************************************************************************/
 void MCU_PowerSave(void);
 
@@ -8,57 +8,61 @@ uint16_t getprnt(uint16_t A,uint16_t m){
 return (A-1)/m;
 } 
 
+//      ,     0
 uint16_t getdeep(uint16_t A ,uint16_t m){
-uint16_t P=1;
 uint16_t i=0;
 
-while (P!=0){
+while (A!=0){
 	i++;
-	P=getprnt(P,m);
+	A=getprnt(A,m);
 };
 return i;
 };
 
 
+//   ,   -    
+typedef struct {
+uint16_t Dst;                //  
+uint16_t Next;               //  
+BOOL Valid;                  //  
+} NWKRouteEntry;
+
+NWKRouteEntry RouteCache[NWK_ROUTE_CACHE_SIZE];
+uint16_t RouteCacheHost=0;   //  ,    
+uint16_t RouteCacheModule=0; //  ,    
+
+
 //    
+//   H    H,       
+// ,      H      H
 uint16_t getnext(uint16_t D ,uint16_t H ,uint16_t m){
-uint16_t DeepHost=getdeep (H,m);
-uint16_t DeepDst=getdeep (D,m);
-uint16_t NextHop=0;
-//   
-if (H==0){
-uint16_t tempd=getdeep (D,m);
-uint16_t nh=D;
+NWKRouteEntry *Entry=&RouteCache[D%NWK_ROUTE_CACHE_SIZE];
+uint16_t NextHop=D;
+uint16_t Prnt;
+uint8_t i;
 
-	while (tempd>1){
-		nh=getprnt(D,m);
-	    tempd=getdeep (nh,m);
-	};
-return nh;
+//     -  
+if ((H!=RouteCacheHost)||(m!=RouteCacheModule)){
+	for (i=0;i<NWK_ROUTE_CACHE_SIZE;i++) RouteCache[i].Valid=FALSE;
+	RouteCacheHost=H;
+	RouteCacheModule=m;
 };
-//      ,   ,      
-if (DeepHost>=DeepDst) return getprnt(H,m);
-//     ,        ,    
-//  ,     
-
 
-    NextHop=D;
-	
-	while (DeepHost!=(DeepDst-1)){
-		NextHop=getprnt(NextHop,m);
-		DeepDst=getdeep(NextHop,m);
+if ((Entry->Valid)&&(Entry->Dst==D)) return Entry->Next;
 
-		};
-//
-	if (getprnt(NextHop, m)==H){
-		return NextHop;
+//      ,   
+if (D==H) NextHop=D;
+else{
+	while (NextHop>H){
+		Prnt=getprnt(NextHop,m);
+		if (Prnt==H) break;
+		NextHop=Prnt;
 	};
-	return getprnt(H,m);
-	
-	
-
-
-
+	if (NextHop<=H) NextHop=getprnt(H,m);
 };
 
-
+Entry->Dst=D;
+Entry->Next=NextHop;
+Entry->Valid=TRUE;
+return NextHop;
+};
@@ -8,16 +8,18 @@
 #include "../../PIL/NWK/MAC/MACLayerDefs.h"
 #include "../../PIL/NWK/MAC/MACLayer.h"
 #include "../../PIL/NWK/NWKLayer.h"
+#include "../../PIL/Timers/Timers.h"
 #include "../../API/CommonAPI.h"
 #include "../../PIL/Utils.h"
+#include <string.h>
 
 
 
 /// MAC layer frame wich must be transmitted
 typedef struct
 {
-	/// MAC layer frame
-	MACLayerFrame *Frame;
+	/// frame buffer holding MPDU
+	NetBuf *Buf;
 	
 	/// MAC layer frame handle
 	uint8_t Handle;
@@ -26,8 +28,65 @@ typedef struct
 	uint8_t TxOptions;
 }MACLayerTxData;
 
-/// MAC layer tx frame
-static volatile MACLayerTxData TxFrame;
+/// MAC layer tx queue, head frame is being transmitted
+static volatile MACLayerTxData TxQueue[MAC_TX_QUEUE_SIZE];
+
+/// index of tx queue head
+static volatile uint8_t TxQueueHead;
+
+/// number of frames in tx queue
+static volatile uint8_t TxQueueCount;
+
+/// number of retransmissions of frame at the head of tx queue
+static volatile uint8_t TxRetries;
+
+/// MAC layer ACK wait timer
+static HTimer AckTimer;
+
+/// SFD time of the last transmission of frame at the head of tx queue
+static volatile uint64_t TxTimestamp;
+
+/// ED scan sample timer
+static HTimer ScanTimer;
+
+/// channels requested for ED scan
+static uint32_t ScanChannels;
+
+/// requested channels not sampled yet
+static uint32_t ScanUnscanned;
+
+/// channel being scanned, 0 if no ED scan is in progress
+static uint8_t ScanChannel;
+
+/// number of energy samples taken on each channel
+static uint16_t ScanSamplesPerChannel;
+
+/// number of energy samples left on current channel
+static uint16_t ScanSamples;
+
+/// peak energy level of every channel of the band
+static int8_t ScanEnergy[MAC_NUM_CHANNELS];
+
+#ifdef PHY_LAYER_HANDLE_CCA_TX
+/// frame at the head of tx queue is loaded to transceiver
+static volatile BOOL TxOnCCA;
+#endif
+
+/// recently received frame
+typedef struct
+{
+	/// source address, short address is zero extended
+	MAC_EXTENDED_ADDR SrcAddr;
+	
+	/// source addressing mode, 0 if entry is empty
+	uint8_t SrcAddrMode;
+	
+	/// sequence number
+	uint8_t DSN;
+}MACLayerRxEntry;
+
+/// recently received frames, the most recent one is the first
+static MACLayerRxEntry DupCache[MAC_DUP_CACHE_SIZE];
 
 /// MAC layer rx frame
 static volatile MACLayerFrame RxFrame;
@@ -35,11 +94,434 @@ static volatile MACLayerFrame RxFrame;
 /// MAC layer defs
 static volatile MACLayerDefsStruct MACLayerDefs;
 
+#ifdef MAC_LAYER_LEGACY_ADDRESSING
+
+/*******************************************************************************//**
+ * prepends legacy MAC header to MSDU, both addressing fields are 8 bytes long
+ * and only destination PAN ID is transmitted, ACK is never requested
+ * @param[in] Frame     MSDU frame
+ * @param[in] TxOptions transmission options
+ * @return SUCCESS if MAC header successfully prepended
+ * @return FAIL    otherwise
+ **********************************************************************************/
+static RESULT MACLayer_PushHeader(MACLayerFrame *Frame,uint8_t TxOptions)
+{
+	uint8_t *Header = NetBuf_Push(Frame->Buf,21);
+	
+	if(Header==NULL)
+		return FAIL;
+	
+	Header[0] = 0x41;
+	if (Frame->SrcAddrMode == 0x02 && Frame->DstAddrMode == 0x02) Header[1] = 0x44;
+	if (Frame->SrcAddrMode == 0x02 && Frame->DstAddrMode == 0x03) Header[1] = 0x4C;
+	if (Frame->SrcAddrMode == 0x03 && Frame->DstAddrMode == 0x02) Header[1] = 0xC4;
+	if (Frame->SrcAddrMode == 0x03 && Frame->DstAddrMode == 0x03) Header[1] = 0xCC;
+	Header[2] = MACLayerDefs.DSN++;
+	Header[3] = (uint8_t)Frame->DstPanID;
+	Header[4] = (uint8_t)(Frame->DstPanID>>8);
+	memcpy(&Header[5],Frame->DstAddr,8);
+	memcpy(&Header[13],Frame->SrcAddr,8);
+	
+	return SUCCESS;
+}
+
+/*******************************************************************************//**
+ * parses legacy MAC header of received frame and sets rx frame addressing
+ * @param[in] Length MPDU length without FCS
+ * @param[in] Data   MPDU
+ * @return MAC header length if frame is addressed to this device
+ * @return 0         otherwise
+ **********************************************************************************/
+static uint8_t MACLayer_ParseHeader(uint8_t Length,uint8_t *Data)
+{
+	// check adress
+	if(Data[0]!=0x41||Length<21)
+		return 0;
+	
+	switch(Data[1])
+	{
+		case 0x44:
+			RxFrame.SrcAddrMode = 0x02;
+			RxFrame.DstAddrMode = 0x02;
+			break;
+		
+		case 0x4C:
+			RxFrame.SrcAddrMode = 0x02;
+			RxFrame.DstAddrMode = 0x03;
+			break;
+		
+		case 0xC4:
+			RxFrame.SrcAddrMode = 0x03;
+			RxFrame.DstAddrMode = 0x02;
+			break;
+		
+		case 0xCC:
+			RxFrame.SrcAddrMode = 0x03;
+			RxFrame.DstAddrMode = 0x03;
+			break;
+		
+		default:
+			return 0;
+		
+	}
+	
+	// check address
+	if(RxFrame.DstAddrMode==0x02)
+	{
+		if((*((MAC_EXTENDED_ADDR*)(&Data[5]))!=MACLayerDefs.ShortAddress)&&
+		   (*((MAC_EXTENDED_ADDR*)(&Data[5]))!=0xFFFF))
+			return 0;
+		
+	}
+	else
+	{
+		if((*((MAC_EXTENDED_ADDR*)(&Data[5]))!=MACLayerDefs.ExtendedAddress)&&
+		   (*((MAC_EXTENDED_ADDR*)(&Data[5]))!=0xFFFF))
+			return 0;
+		
+	}
+	
+	// check pan ID
+	if(*((uint16_t*)(&Data[3]))!=MACLayerDefs.PanID)
+		return 0;
+	
+	RxFrame.SrcPanID    = MACLayerDefs.PanID;
+	RxFrame.SrcAddr     = (uint8_t*)&Data[13];
+	RxFrame.DstPanID    = MACLayerDefs.PanID;
+	RxFrame.DstAddr     = (uint8_t*)&Data[5];
+	
+	return 21;
+}
+
+#else
+
+/*******************************************************************************//**
+ * returns length of addressing field
+ * @param[in] AddrMode addressing mode
+ * @return 2 for short address, 8 for extended address
+ * @return 0 otherwise
+ **********************************************************************************/
+static uint8_t MACLayer_GetAddrLength(uint8_t AddrMode)
+{
+	if(AddrMode==MAC_ADDR_MODE_SHORT)
+		return 2;
+	
+	if(AddrMode==MAC_ADDR_MODE_EXTENDED)
+		return 8;
+	
+	return 0;
+}
+
+/*******************************************************************************//**
+ * prepends MAC header to MSDU, IEEE802.15.4 paragraph - 7.2.1
+ * addressing fields are as long as addressing modes require, source PAN ID
+ * is omitted if it equals destination PAN ID
+ * @param[in] Frame     MSDU frame
+ * @param[in] TxOptions transmission options
+ * @return SUCCESS if MAC header successfully prepended
+ * @return FAIL    otherwise
+ **********************************************************************************/
+static RESULT MACLayer_PushHeader(MACLayerFrame *Frame,uint8_t TxOptions)
+{
+	uint8_t DstAddrMode = Frame->DstAddrMode;
+	uint8_t *DstAddr    = Frame->DstAddr;
+	uint8_t DstAddrLength,SrcAddrLength,HeaderLength;
+	uint16_t Broadcast  = MAC_SHORT_BROADCAST_ADDR;
+	BOOL PanIDCompression,AckRequest;
+	uint8_t *Header;
+	
+	// broadcast is always sent to short broadcast address
+	if(DstAddrMode==MAC_ADDR_MODE_EXTENDED&&
+	   (*((MAC_EXTENDED_ADDR*)DstAddr)==MAC_SHORT_BROADCAST_ADDR||
+	    *((MAC_EXTENDED_ADDR*)DstAddr)==MAC_EXTENDED_BROADCAST_ADDR))
+	{
+		DstAddrMode = MAC_ADDR_MODE_SHORT;
+		DstAddr     = (uint8_t*)&Broadcast;
+		
+	}
+	
+	// broadcast frames are never acknowledged
+	#ifdef PHY_LAYER_HANDLE_ACK
+	AckRequest = (TxOptions&MAC_TX_OPTION_ACK)&&
+	             !(DstAddrMode==MAC_ADDR_MODE_SHORT&&
+	               *((MAC_SHORT_ADDR*)DstAddr)==MAC_SHORT_BROADCAST_ADDR);
+	#else
+	AckRequest = FALSE;
+	#endif
+	
+	// get addressing fields length
+	DstAddrLength = MACLayer_GetAddrLength(DstAddrMode);
+	SrcAddrLength = MACLayer_GetAddrLength(Frame->SrcAddrMode);
+	if(DstAddrLength==0||SrcAddrLength==0)
+		return FAIL;
+	
+	PanIDCompression = (Frame->SrcPanID==Frame->DstPanID);
+	HeaderLength     = 5+DstAddrLength+SrcAddrLength;
+	if(!PanIDCompression)
+		HeaderLength += 2;
+	
+	Header = NetBuf_Push(Frame->Buf,HeaderLength);
+	if(Header==NULL)
+		return FAIL;
+	
+	// frame control and sequence number
+	Header[0] = MAC_FCF_FRAME_TYPE_DATA;
+	if(PanIDCompression)
+		Header[0] |= MAC_FCF_PAN_ID_COMPRESSION;
+	if(AckRequest)
+		Header[0] |= MAC_FCF_ACK_REQUEST;
+	Header[1] = (Frame->SrcAddrMode<<6)|(DstAddrMode<<2);
+	Header[2] = MACLayerDefs.DSN++;
+	
+	// destination PAN ID and address
+	Header[3] = (uint8_t)Frame->DstPanID;
+	Header[4] = (uint8_t)(Frame->DstPanID>>8);
+	memcpy(&Header[5],DstAddr,DstAddrLength);
+	Header += 5+DstAddrLength;
+	
+	// source PAN ID and address
+	if(!PanIDCompression)
+	{
+		Header[0] = (uint8_t)Frame->SrcPanID;
+		Header[1] = (uint8_t)(Frame->SrcPanID>>8);
+		Header += 2;
+		
+	}
+	memcpy(Header,Frame->SrcAddr,SrcAddrLength);
+	
+	return SUCCESS;
+}
+
+/*******************************************************************************//**
+ * parses MAC header of received frame and sets rx frame addressing,
+ * IEEE802.15.4 paragraph - 7.2.1
+ * @param[in] Length MPDU length without FCS
+ * @param[in] Data   MPDU
+ * @return MAC header length if frame is addressed to this device
+ * @return 0         otherwise
+ **********************************************************************************/
+static uint8_t MACLayer_ParseHeader(uint8_t Length,uint8_t *Data)
+{
+	uint8_t DstAddrLength,SrcAddrLength,HeaderLength;
+	BOOL PanIDCompression;
+	uint16_t DstPanID;
+	
+	// accept only unsecured data frames
+	if((Data[0]&(MAC_FCF_FRAME_TYPE_MASK|MAC_FCF_SECURITY_ENABLED))!=
+	   MAC_FCF_FRAME_TYPE_DATA)
+		return 0;
+	
+	// get addressing fields length
+	RxFrame.DstAddrMode = (Data[1]>>2)&0x03;
+	RxFrame.SrcAddrMode = (Data[1]>>6)&0x03;
+	DstAddrLength = MACLayer_GetAddrLength(RxFrame.DstAddrMode);
+	SrcAddrLength = MACLayer_GetAddrLength(RxFrame.SrcAddrMode);
+	if(DstAddrLength==0||SrcAddrLength==0)
+		return 0;
+	
+	PanIDCompression = ((Data[0]&MAC_FCF_PAN_ID_COMPRESSION)!=0);
+	HeaderLength     = 5+DstAddrLength+SrcAddrLength;
+	if(!PanIDCompression)
+		HeaderLength += 2;
+	
+	// check length
+	if(Length<HeaderLength)
+		return 0;
+	
+	// check pan ID
+	DstPanID = Data[3]|((uint16_t)Data[4]<<8);
+	if(DstPanID!=MACLayerDefs.PanID&&DstPanID!=MAC_SHORT_BROADCAST_ADDR)
+		return 0;
+	
+	// check address
+	if(RxFrame.DstAddrMode==MAC_ADDR_MODE_SHORT)
+	{
+		if((*((MAC_SHORT_ADDR*)(&Data[5]))!=MACLayerDefs.ShortAddress)&&
+		   (*((MAC_SHORT_ADDR*)(&Data[5]))!=MAC_SHORT_BROADCAST_ADDR))
+			return 0;
+		
+	}
+	else
+	{
+		if((*((MAC_EXTENDED_ADDR*)(&Data[5]))!=MACLayerDefs.ExtendedAddress)&&
+		   (*((MAC_EXTENDED_ADDR*)(&Data[5]))!=MAC_EXTENDED_BROADCAST_ADDR))
+			return 0;
+		
+	}
+	
+	RxFrame.DstPanID = DstPanID;
+	RxFrame.DstAddr  = (uint8_t*)&Data[5];
+	Data += 5+DstAddrLength;
+	
+	if(PanIDCompression)
+	{
+		RxFrame.SrcPanID = DstPanID;
+		
+	}
+	else
+	{
+		RxFrame.SrcPanID = Data[0]|((uint16_t)Data[1]<<8);
+		Data += 2;
+		
+	}
+	RxFrame.SrcAddr = Data;
+	
+	return HeaderLength;
+}
+
+#endif
+
+/*******************************************************************************//**
+ * checks if received frame was already received and remembers it otherwise,
+ * retransmitted frame keeps its sequence number if its ACK was lost
+ * @param[in] DSN sequence number of rx frame
+ * @return TRUE  if frame is duplicate
+ * @return FALSE otherwise
+ **********************************************************************************/
+static BOOL MACLayer_IsDuplicate(uint8_t DSN)
+{
+	MAC_EXTENDED_ADDR SrcAddr = 0;
+	uint8_t i;
+	
+	memcpy(&SrcAddr,RxFrame.SrcAddr,
+	       RxFrame.SrcAddrMode==MAC_ADDR_MODE_SHORT?sizeof(MAC_SHORT_ADDR):sizeof(MAC_EXTENDED_ADDR));
+	
+	// find frame, the last entry is replaced if it is not found
+	for(i=0;i<MAC_DUP_CACHE_SIZE-1;++i)
+		if(DupCache[i].SrcAddrMode==RxFrame.SrcAddrMode&&
+		   DupCache[i].SrcAddr==SrcAddr)
+			break;
+	
+	if(DupCache[i].SrcAddrMode==RxFrame.SrcAddrMode&&
+	   DupCache[i].SrcAddr==SrcAddr&&DupCache[i].DSN==DSN)
+		return TRUE;
+	
+	// move source to the front
+	memmove(&DupCache[1],&DupCache[0],i*sizeof(MACLayerRxEntry));
+	DupCache[0].SrcAddr     = SrcAddr;
+	DupCache[0].SrcAddrMode = RxFrame.SrcAddrMode;
+	DupCache[0].DSN         = DSN;
+	
+	return FALSE;
+}
+
+/*******************************************************************************//**
+ * begins CSMA-CA for frame at the head of tx queue
+ **********************************************************************************/
+static void MACLayer_TxStart(void)
+{
+	// frame is transmitted right from the buffer
+	MACLayerDefs.TxBuf = TxQueue[TxQueueHead].Buf;
+	
+	// begin CSMA-CA, receiver stays on, because transceiver acknowledges
+	// frames by itself and they must not be lost while frame is sent
+	MACLayerDefs.State = MAC_LAYER_STATE_TX_CSMA_CA;
+	PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
+}
+
+/*******************************************************************************//**
+ * removes frame at the head of tx queue, confirms it and starts transmission
+ * of the next frame if any
+ * @param[in] Status the result of transmission
+ **********************************************************************************/
+static void MACLayer_TxDone(MAC_ENUM Status)
+{
+	uint8_t Handle;
+	uint64_t Timestamp;
+	BOOL Next;
+	
+	TxRetries   = 0;
+	Timestamp   = TxTimestamp;
+	TxTimestamp = 0;
+	
+	BEGIN_CRITICAL_SECTION
+	{
+		// dequeue frame
+		Handle      = TxQueue[TxQueueHead].Handle;
+		TxQueueHead = (TxQueueHead+1)%MAC_TX_QUEUE_SIZE;
+		--TxQueueCount;
+		Next = (TxQueueCount!=0);
+		
+		// frames requested while confirming are started by request
+		// only if queue is empty
+		if(!Next)
+			MACLayerDefs.State = MAC_LAYER_STATE_RX;
+	}
+	END_CRITICAL_SECTION
+	
+	MACLayerDefs.TxBuf = NULL;
+	
+	// change state to rx
+	if(!Next)
+		PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
+	
+	// confirm
+	MACLayer_DATA_Confirm(Handle,Status,Timestamp);
+	
+	// transmit next frame
+	if(Next)
+		MACLayer_TxStart();
+	
+}
+
+/*******************************************************************************//**
+ * checks if frame being transmitted requests ACK
+ * @return TRUE  if ACK is requested
+ * @return FALSE otherwise
+ **********************************************************************************/
+static BOOL MACLayer_TxAckRequested(void)
+{
+	return (NETBUF_DATA(MACLayerDefs.TxBuf)[0]&MAC_FCF_ACK_REQUEST)!=0;
+}
+
+/*******************************************************************************//**
+ * MAC layer ACK wait timer "fired" event, frame is retransmitted with the same
+ * sequence number until retries are exhausted, IEEE802.15.4 paragraph - 7.5.6.4.3
+ **********************************************************************************/
+EVENT MACLayer_AckTimerFired(PARAM Param)
+{
+	// ACK may have been received meanwhile
+	if(MACLayerDefs.State!=MAC_LAYER_STATE_TX_WAITING_ACK)
+		return;
+	
+	// if retries are not exhausted
+	if(TxRetries<MAC_A_MAX_FRAME_RETRIES)
+	{
+		// retransmit frame
+		++TxRetries;
+		MACLayer_TxStart();
+		
+	}
+	// else
+	else
+	{
+		// signal no ACK
+		MACLayer_TxDone(MAC_NO_ACK);
+		
+	}
+	
+}
+
 /*******************************************************************************//**
  * @implements MACLayerCSMACA_Done
  **********************************************************************************/
 EVENT MACLayerCSMACA_Done(RESULT Result)
 {
+	#ifdef PHY_LAYER_HANDLE_CCA_TX
+	// if frame is already being sent
+	if(Result==SUCCESS&&TxOnCCA)
+	{
+		MACLayerDefs.State = MAC_LAYER_STATE_TX_SENDING;
+		
+		// transceiver returns to rx right after frame is sent to catch ACK
+		if(MACLayer_TxAckRequested())
+			PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
+		
+		return;
+		
+	}
+	#endif
+	
 	// if success
 	if(Result==SUCCESS)
 	{
@@ -52,11 +534,7 @@ EVENT MACLayerCSMACA_Done(RESULT Result)
 	else
 	{
 		// signal channel access failure
-		MACLayer_DATA_Confirm(TxFrame.Handle,MAC_CHANNEL_ACCESS_FAILURE);
-		
-		// change state to rx
-		MACLayerDefs.State = MAC_LAYER_STATE_RX;
-		PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
+		MACLayer_TxDone(MAC_CHANNEL_ACCESS_FAILURE);
 		
 	}
 	
@@ -76,9 +554,19 @@ RESULT MACLayer_Init(void)
 	MACLayerDefs.AckWaitDuration = 54;
 	MACLayerDefs.ShortAddress    = 0xFFFF;
 	MACLayerDefs.PanID           = DEFAULT_PAN_ID;
-	MACLayerDefs.TxLen           = 0;
+	MACLayerDefs.TxBuf           = NULL;
 	MACLayerDefs.State           = MAC_LAYER_STATE_RX;
-	TxFrame.Frame = NULL;
+	TxQueueHead  = 0;
+	TxQueueCount = 0;
+	TxRetries    = 0;
+	TxTimestamp  = 0;
+	ScanChannel  = 0;
+	memset(DupCache,0,sizeof(DupCache));
+	
+	// create ACK wait timer
+	AckTimer = Timer_Create(MACLayer_AckTimerFired,NULL);
+	if(IS_INVALID_HANDLE(AckTimer))
+		return FAIL;
 	
 	// init MAC layer CSMA-CA
 	return MACLayerCSMACA_Init();
@@ -98,103 +586,68 @@ MACLayerDefsStruct* MACLayer_GetDefs(void)
 RESULT MACLayer_DATA_Request(MACLayerFrame *Frame,uint8_t Handle,
                              uint8_t TxOptions)
 {
-	uint8_t i;
-	MAC_LAYER_STATE State;
+	BOOL Start;
 	
 	// check radio transceiver state
 	if(Radio_GetState()==RADIO_STATE_POWER_DOWN)
 		return FAIL;
 	
-	BEGIN_CRITICAL_SECTION
-	{
-		State = MACLayerDefs.State;
-		
-		// check current state
-		if(State==MAC_LAYER_STATE_RX)
-			MACLayerDefs.State = MAC_LAYER_STATE_TX;
-	}
-	END_CRITICAL_SECTION
-	
-	if(State!=MAC_LAYER_STATE_RX)
+	// check queue, frames are only removed from it meanwhile
+	if(TxQueueCount==MAC_TX_QUEUE_SIZE)
 		return FAIL;
 	
-	// set frame
-	TxFrame.Frame     = Frame;
-	TxFrame.Handle    = Handle;
-	TxFrame.TxOptions = TxOptions;
-	
 	// check frame
-	if(TxFrame.Frame==NULL)
+	if(Frame==NULL||Frame->Buf==NULL)
 	{
-		MACLayerDefs.State = MAC_LAYER_STATE_RX;
-		PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
-		
-		SIGNAL_EVENT(MACLayer_DATA_Confirm(TxFrame.Handle,MAC_INVALID_PARAMETER))
+		SIGNAL_EVENT(MACLayer_DATA_Confirm(Handle,MAC_INVALID_PARAMETER,0))
 		
 		return SUCCESS;
 		
 	}
 	
-	if(TxFrame.Frame->Data==NULL)
+	// check length
+	if(Frame->Buf->Length>MAC_A_MAX_MAC_FRAME_SIZE-2)
 	{
-		MACLayerDefs.State = MAC_LAYER_STATE_RX;
-		PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
-		
-		SIGNAL_EVENT(MACLayer_DATA_Confirm(TxFrame.Handle,MAC_INVALID_PARAMETER))
+		SIGNAL_EVENT(MACLayer_DATA_Confirm(Handle,MAC_FRAME_TOO_LONG,0))
 		
 		return SUCCESS;
 		
 	}
 	
-	// check length
-	if(TxFrame.Frame->Length>MAC_A_MAX_MAC_FRAME_SIZE-2)
+	// construct MPDU in front of MSDU, so frame does not depend
+	// on caller's addresses while it is queued
+	if(MACLayer_PushHeader(Frame,TxOptions)==FAIL)
 	{
-		MACLayerDefs.State = MAC_LAYER_STATE_RX;
-		PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
+		SIGNAL_EVENT(MACLayer_DATA_Confirm(Handle,MAC_INVALID_PARAMETER,0))
+		
+		return SUCCESS;
 		
-		SIGNAL_EVENT(MACLayer_DATA_Confirm(TxFrame.Handle,MAC_FRAME_TOO_LONG))
-		
-	}
-	
-	// construct MSDU
-	MACLayerDefs.TxLen = 0;
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = 0x41;
-	if (TxFrame.Frame->SrcAddrMode == 0x02 && TxFrame.Frame->DstAddrMode == 0x02) MACLayerDefs.TxData[MACLayerDefs.TxLen++] = 0x44;
-	if (TxFrame.Frame->SrcAddrMode == 0x02 && TxFrame.Frame->DstAddrMode == 0x03) MACLayerDefs.TxData[MACLayerDefs.TxLen++] = 0x4C;
-	if (TxFrame.Frame->SrcAddrMode == 0x03 && TxFrame.Frame->DstAddrMode == 0x02) MACLayerDefs.TxData[MACLayerDefs.TxLen++] = 0xC4;
-	if (TxFrame.Frame->SrcAddrMode == 0x03 && TxFrame.Frame->DstAddrMode == 0x03) MACLayerDefs.TxData[MACLayerDefs.TxLen++] = 0xCC;
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = MACLayerDefs.DSN++;
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = (uint8_t)TxFrame.Frame->DstPanID;
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = (uint8_t)(TxFrame.Frame->DstPanID>>8);
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->DstAddr[0];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->DstAddr[1];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->DstAddr[2];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->DstAddr[3];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->DstAddr[4];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->DstAddr[5];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->DstAddr[6];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->DstAddr[7];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->SrcAddr[0];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->SrcAddr[1];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->SrcAddr[2];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->SrcAddr[3];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->SrcAddr[4];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->SrcAddr[5];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->SrcAddr[6];
-	MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->SrcAddr[7];
-	
-	for(i=0;i<TxFrame.Frame->Length;++i)
-		MACLayerDefs.TxData[MACLayerDefs.TxLen++] = TxFrame.Frame->Data[i];
+	}
 	
 	#ifndef PHY_LAYER_HANDLE_CHECKSUM
-	*((uint16_t*)(&MACLayerDefs.TxData[MACLayerDefs.TxLen])) = 
-	    Utils_ITUTCRC16(MACLayerDefs.TxLen,(uint8_t*)MACLayerDefs.TxData);
-	MACLayerDefs.TxLen += 2;
+	*((uint16_t*)NetBuf_Put(Frame->Buf,2)) = 
+	    Utils_ITUTCRC16(Frame->Buf->Length-2,NETBUF_DATA(Frame->Buf));
 	#endif
 	
-	// begin CSMA-CA
-	MACLayerDefs.State = MAC_LAYER_STATE_TX_CSMA_CA;
-	PHYLayer_SETTRXSTATE_Request(PHY_RX_ON_REJECT_ALL);
+	BEGIN_CRITICAL_SECTION
+	{
+		// enqueue frame
+		uint8_t Tail = (TxQueueHead+TxQueueCount)%MAC_TX_QUEUE_SIZE;
+		
+		TxQueue[Tail].Buf       = Frame->Buf;
+		TxQueue[Tail].Handle    = Handle;
+		TxQueue[Tail].TxOptions = TxOptions;
+		++TxQueueCount;
+		
+		// start transmission if MAC layer is idle
+		Start = (MACLayerDefs.State==MAC_LAYER_STATE_RX);
+		if(Start)
+			MACLayerDefs.State = MAC_LAYER_STATE_TX_CSMA_CA;
+	}
+	END_CRITICAL_SECTION
+	
+	if(Start)
+		MACLayer_TxStart();
 	
 	// return success
 	return SUCCESS;
@@ -205,22 +658,39 @@ RESULT MACLayer_DATA_Request(MACLayerFrame *Frame,uint8_t Handle,
  **********************************************************************************/
 EVENT PHYLayer_DATA_Confirm(PHY_ENUM Status)
 {
-	// if success
-	if(Status==PHY_SUCCESS)
+	// check current state
+	if(MACLayerDefs.State!=MAC_LAYER_STATE_TX_SENDING)
+		return;
+	
+	// if failure
+	if(Status!=PHY_SUCCESS)
 	{
-		// confirm
-		MACLayer_DATA_Confirm(TxFrame.Handle,MAC_SUCCESS);
+		// change state to tx
+		MACLayerDefs.State = MAC_LAYER_STATE_TX;
+		PHYLayer_SETTRXSTATE_Request(PHY_TX_ON);
 		
-		// change state to rx
-		MACLayerDefs.State = MAC_LAYER_STATE_RX;
-		PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
+		return;
+		
+	}
+	
+	// frame is sent, save its SFD time before ACK overwrites it
+	TxTimestamp = PHYLayer_GetLastSFDTime();
+	
+	// if ACK is requested
+	if(MACLayer_TxAckRequested())
+	{
+		// wait for ACK, transceiver is already returning to rx
+		MACLayerDefs.State = MAC_LAYER_STATE_TX_WAITING_ACK;
+		if(Timer_Start(AckTimer,TIMER_ONE_SHOT_MODE,
+		               (PERIOD)MACLayerDefs.AckWaitDuration*PHY_SYMBOL_DURATION)==FAIL)
+			MACLayer_TxDone(MAC_NO_ACK);
 		
 	}
 	// else
 	else
 	{
-		// change state to tx
-		PHYLayer_SETTRXSTATE_Request(PHY_TX_ON);
+		// confirm
+		MACLayer_TxDone(MAC_SUCCESS);
 		
 	}
 	
@@ -231,9 +701,31 @@ EVENT PHYLayer_DATA_Confirm(PHY_ENUM Status)
  **********************************************************************************/
 EVENT PHYLayer_DATA_Indication(uint8_t Length,uint8_t *Data,uint8_t LinkQuality)
 {
-	// check current state
-	if(MACLayerDefs.State!=MAC_LAYER_STATE_RX)
-		return;
+	uint8_t HeaderLength;
+	
+	// check ACK of frame being transmitted, ACK frame is 3 bytes long
+	// without FCS, IEEE802.15.4 paragraph - 7.2.2.3
+	if(MACLayerDefs.State==MAC_LAYER_STATE_TX_WAITING_ACK)
+	{
+		#ifdef PHY_LAYER_HANDLE_CHECKSUM
+		if(Length==3&&
+		#else
+		if(Length==5&&
+		#endif
+		   (Data[0]&MAC_FCF_FRAME_TYPE_MASK)==MAC_FCF_FRAME_TYPE_ACK&&
+		   Data[2]==NETBUF_DATA(MACLayerDefs.TxBuf)[2])
+		{
+			Timer_Stop(AckTimer);
+			MACLayer_TxDone(MAC_SUCCESS);
+			
+			return;
+			
+		}
+		
+	}
+	
+	// data frames are accepted in all states, because transceiver
+	// has already acknowledged them
 	
 	// check length
 	if(Length<=4)
@@ -247,66 +739,123 @@ EVENT PHYLayer_DATA_Indication(uint8_t Length,uint8_t *Data,uint8_t LinkQuality)
 	Length -= 2;
 	#endif
 	
-	// check adress
-	if(Data[0]!=0x41||Length<19)
+	// parse MAC header
+	HeaderLength = MACLayer_ParseHeader(Length,Data);
+	if(HeaderLength==0)
 		return;
-		
-	switch (Data[1])
-		{
-		case 0x44:
-		RxFrame.SrcAddrMode = 0x02;
-		RxFrame.DstAddrMode = 0x02;
-			// check address
-			if((*((MAC_EXTENDED_ADDR*)(&Data[5]))!=MACLayerDefs.ShortAddress)&&
-			(*((MAC_EXTENDED_ADDR*)(&Data[5]))!=0xFFFF))
-			return;
-		break;
-
-		case 0x4C:
-		RxFrame.SrcAddrMode = 0x02;
-		RxFrame.DstAddrMode = 0x03;
-					// check address
-			if((*((MAC_EXTENDED_ADDR*)(&Data[5]))!=MACLayerDefs.ExtendedAddress)&&
-			(*((MAC_EXTENDED_ADDR*)(&Data[5]))!=0xFFFF))
-			return;
-		break;
+	
+	// drop duplicate
+	if(MACLayer_IsDuplicate(Data[2]))
+		return;
+	
+	// set rx frame params
+	RxFrame.Length      = Length-HeaderLength;
+	RxFrame.Data        = (uint8_t*)&Data[HeaderLength];
+	
+	// signal data indication
+	MACLayer_DATA_Indication((MACLayerFrame*)&RxFrame,LinkQuality,FALSE,0);
+	
+}
 
-		case 0xC4:
-		RxFrame.SrcAddrMode = 0x03;
-		RxFrame.DstAddrMode = 0x02;
-					// check address
-			if((*((MAC_EXTENDED_ADDR*)(&Data[5]))!=MACLayerDefs.ShortAddress)&&
-			(*((MAC_EXTENDED_ADDR*)(&Data[5]))!=0xFFFF))
-			return;
-		break;
+/*******************************************************************************//**
+ * switches ED scan to the next requested channel
+ * @return TRUE  if radio is switched to the next channel
+ * @return FALSE if there are no channels left
+ **********************************************************************************/
+static BOOL MACLayer_ScanNextChannel(void)
+{
+	for(++ScanChannel;ScanChannel<=MAC_LAST_CHANNEL;++ScanChannel)
+	{
+		if(!(ScanChannels&((uint32_t)1<<ScanChannel)))
+			continue;
+		
+		if(PHYLayer_SET_Request(PHY_PIB_CURRENT_CHANNEL_ID,(uint32_t)ScanChannel)!=SUCCESS)
+			continue;
+		
+		// first sample is dropped, RSSI is not valid until 8 symbols
+		// after receiver is turned on at new channel
+		ScanSamples = ScanSamplesPerChannel+1;
+		return TRUE;
+		
+	}
+	
+	return FALSE;
+}
 
-		case 0xCC:
-		RxFrame.SrcAddrMode = 0x03;
-		RxFrame.DstAddrMode = 0x03;
-					// check address
-			if((*((MAC_EXTENDED_ADDR*)(&Data[5]))!=MACLayerDefs.ExtendedAddress)&&
-			(*((MAC_EXTENDED_ADDR*)(&Data[5]))!=0xFFFF))
-			return;
-		break;				
-		}
+/*******************************************************************************//**
+ * finishes ED scan
+ **********************************************************************************/
+static void MACLayer_ScanDone(void)
+{
+	ScanChannel = 0;
+	Timer_Destroy(ScanTimer);
 	
-	// check pan ID
-	if(*((uint16_t*)(&Data[3]))!=MACLayerDefs.PanID)
+	MACLayer_ED_SCAN_Confirm(MAC_SUCCESS,ScanUnscanned,ScanEnergy);
+}
+
+/*******************************************************************************//**
+ * MAC layer ED scan timer "fired" event, energy of current channel is sampled
+ **********************************************************************************/
+EVENT MACLayer_ScanTimerFired(PARAM Param)
+{
+	if(ScanChannel==0)
 		return;
 	
+	// radio has been turned off
+	if(PHYLayer_ED_Request()!=SUCCESS)
+		MACLayer_ScanDone();
+	
+}
 
+/*******************************************************************************//**
+ * @implements MACLayer_ED_SCAN_Request
+ **********************************************************************************/
+RESULT MACLayer_ED_SCAN_Request(uint32_t Channels,uint16_t ScanDuration)
+{
+	uint8_t i;
 	
-	// set rx frame params
-	RxFrame.SrcPanID    = MACLayerDefs.PanID;
-	RxFrame.SrcAddr     = (uint8_t*)&Data[13];
-	RxFrame.DstPanID    = MACLayerDefs.PanID;
-	RxFrame.DstAddr     = (uint8_t*)&Data[5];
-	RxFrame.Length      = Length-21;
-	RxFrame.Data        = (uint8_t*)&Data[21];
+	// check scan state and channels
+	Channels &= MAC_ALL_CHANNELS;
+	if(ScanChannel!=0||Channels==0)
+		return FAIL;
 	
-	// signal data indication
-	MACLayer_DATA_Indication((MACLayerFrame*)&RxFrame,LinkQuality,FALSE,0);
+	ScanChannels          = Channels;
+	ScanUnscanned         = Channels;
+	ScanSamplesPerChannel = ScanDuration/MAC_ED_SAMPLE_PERIOD;
+	if(ScanSamplesPerChannel==0)
+		ScanSamplesPerChannel = 1;
+	
+	for(i=0;i<MAC_NUM_CHANNELS;++i)
+		ScanEnergy[i] = -128;
+	
+	// switch to the first channel
+	ScanChannel = MAC_FIRST_CHANNEL-1;
+	if(!MACLayer_ScanNextChannel())
+	{
+		ScanChannel = 0;
+		return FAIL;
+		
+	}
+	
+	// start sampling
+	ScanTimer = Timer_Create(MACLayer_ScanTimerFired,NULL);
+	if(IS_INVALID_HANDLE(ScanTimer))
+	{
+		ScanChannel = 0;
+		return FAIL;
+		
+	}
 	
+	if(Timer_Start(ScanTimer,TIMER_CYCLIC_MODE,MS(MAC_ED_SAMPLE_PERIOD))!=SUCCESS)
+	{
+		ScanChannel = 0;
+		Timer_Destroy(ScanTimer);
+		return FAIL;
+		
+	}
+	
+	// return success
+	return SUCCESS;
 }
 
 /*******************************************************************************//**
@@ -315,7 +864,39 @@ EVENT PHYLayer_DATA_Indication(uint8_t Length,uint8_t *Data,uint8_t LinkQuality)
 EVENT PHYLayer_ED_Confirm(PHY_ENUM Status,
                           int8_t EnergyLevel)
 {
-	// empty
+	// no ED scan is in progress
+	if(ScanChannel==0)
+		return;
+	
+	// transceiver has been turned off, scan is aborted
+	if(Status==PHY_TRX_OFF)
+	{
+		MACLayer_ScanDone();
+		return;
+		
+	}
+	
+	// transceiver is transmitting, sample is taken again
+	if(Status!=PHY_SUCCESS)
+		return;
+	
+	// keep peak energy level
+	if(ScanSamples<=ScanSamplesPerChannel)
+	{
+		if(EnergyLevel>ScanEnergy[ScanChannel-MAC_FIRST_CHANNEL])
+			ScanEnergy[ScanChannel-MAC_FIRST_CHANNEL] = EnergyLevel;
+		
+		ScanUnscanned &= ~((uint32_t)1<<ScanChannel);
+		
+	}
+	
+	if(--ScanSamples!=0)
+		return;
+	
+	// all channels are scanned
+	if(!MACLayer_ScanNextChannel())
+		MACLayer_ScanDone();
+	
 }
 
 /*******************************************************************************//**
@@ -334,18 +915,26 @@ EVENT PHYLayer_GET_Confirm(PHY_ENUM Status,
 EVENT PHYLayer_SETTRXSTATE_Confirm(PHY_ENUM Status)
 {
 	// CSMA-CA
-	if(Status!=PHY_SUCCESS&&Status!=PHY_RX_ON_REJECT_ALL&&
+	if(Status!=PHY_SUCCESS&&Status!=PHY_RX_ON&&
 	   MACLayerDefs.State==MAC_LAYER_STATE_TX_CSMA_CA)
 	{
-		// request state change to RX_ON_REJECT_ALL
-		PHYLayer_SETTRXSTATE_Request(PHY_RX_ON_REJECT_ALL);
+		// request state change to RX_ON
+		PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
 		return;
 		
 	}
 	else if(MACLayerDefs.State==MAC_LAYER_STATE_TX_CSMA_CA)
 	{
 		// start CSMA-CA
-		MACLayerCSMACA_Start();
+		#ifdef PHY_LAYER_HANDLE_CCA_TX
+		// frame is loaded before backoff, so transceiver sends it right after CCA,
+		// otherwise CCA and tx are requested one by one
+		TxOnCCA = (PHYLayer_LoadTx(MACLayerDefs.TxBuf->Length,
+		                           NETBUF_DATA(MACLayerDefs.TxBuf))==SUCCESS);
+		MACLayerCSMACA_Start(TxOnCCA);
+		#else
+		MACLayerCSMACA_Start(FALSE);
+		#endif
 		return;
 		
 	}
@@ -368,7 +957,12 @@ EVENT PHYLayer_SETTRXSTATE_Confirm(PHY_ENUM Status)
 	}
 	else if(MACLayerDefs.State==MAC_LAYER_STATE_TX)
 	{
-		PHYLayer_DATA_Request(MACLayerDefs.TxLen,(uint8_t*)MACLayerDefs.TxData);
+		MACLayerDefs.State = MAC_LAYER_STATE_TX_SENDING;
+		PHYLayer_DATA_Request(MACLayerDefs.TxBuf->Length,NETBUF_DATA(MACLayerDefs.TxBuf));
+		
+		// transceiver returns to rx right after frame is sent to catch ACK
+		if(MACLayer_TxAckRequested())
+			PHYLayer_SETTRXSTATE_Request(PHY_RX_ON);
 		
 	}
 	
@@ -7,11 +7,57 @@
 #ifndef __MAC_LAYER_H__
 #define __MAC_LAYER_H__
 
+#include "../../PIL/NWK/NetBuf.h"
 #include "../../PIL/Defs.h"
 
 /// MAC broadcast extended 64 bit address
 #define MAC_EXTENDED_BROADCAST_ADDR 0xFFFFFFFFFFFFFFFF
 
+/// number of frames MAC layer can queue for transmission
+#ifndef MAC_TX_QUEUE_SIZE
+#define MAC_TX_QUEUE_SIZE 3
+#endif
+
+/// number of recently received frames remembered to drop duplicates
+#ifndef MAC_DUP_CACHE_SIZE
+#define MAC_DUP_CACHE_SIZE 8
+#endif
+
+/// MAC broadcast short 16 bit address and PAN ID
+#define MAC_SHORT_BROADCAST_ADDR 0xFFFF
+
+/// period in milli seconds ED scan samples channel energy with
+#ifndef MAC_ED_SAMPLE_PERIOD
+#define MAC_ED_SAMPLE_PERIOD 2
+#endif
+
+/// first and last channel of 2.4 GHz band IEEE802.15.4 paragraph - 6.1.2,
+/// bit n of channel mask selects channel n
+#define MAC_FIRST_CHANNEL 11
+#define MAC_LAST_CHANNEL  26
+
+/// number of channels of 2.4 GHz band
+#define MAC_NUM_CHANNELS  (MAC_LAST_CHANNEL-MAC_FIRST_CHANNEL+1)
+
+/// mask of all channels of 2.4 GHz band
+#define MAC_ALL_CHANNELS  0x07FFF800ul
+
+/// MAC layer builds headers with variable length addressing fields and
+/// PAN ID compression, define MAC_LAYER_LEGACY_ADDRESSING to keep the
+/// fixed 21 byte header of older firmware, all nodes of the network
+/// must be built with the same setting
+
+/// MAC addressing modes IEEE802.15.4 table - 79
+enum
+{
+	/// no address
+	MAC_ADDR_MODE_NONE     = 0x00,
+	/// 16 bit short address
+	MAC_ADDR_MODE_SHORT    = 0x02,
+	/// 64 bit extended address
+	MAC_ADDR_MODE_EXTENDED = 0x03
+};
+
 /// MAC enumerations IEEE802.15.4 table - 64
 typedef enum
 {
@@ -29,6 +75,13 @@ typedef enum
 	MAC_UNSUPPORTED_ATTRIBUTE  = 0xF4
 }MAC_ENUM;
 
+/// MAC transmission options IEEE802.15.4 paragraph - 7.1.1.1.1
+enum
+{
+	/// acknowledged transmission, ignored for broadcast frames
+	MAC_TX_OPTION_ACK = 0x01
+};
+
 /// MAC PIB attributes IEEE802.15.4 table - 71
 typedef enum
 {
@@ -93,6 +146,10 @@ typedef struct
 	
 	/// MSDU
 	uint8_t  *Data;
+	
+	/// frame buffer holding MSDU to transmit, MAC header is
+	/// prepended in its headroom, Length and Data are not used
+	NetBuf   *Buf;
 }MACLayerFrame;
 
 /*******************************************************************************//**
@@ -105,6 +162,9 @@ RESULT MACLayer_Init(void);
 /*******************************************************************************//**
  * MCPS-DATA.request
  * IEEE802.15.4 paragraph - 7.1.1.1
+ * frame is queued, MACLayer_DATA_Confirm is signalled with the same handle
+ * when its transmission is finished, frame buffer must not be changed
+ * until then, frame structure itself may be reused right after the call
  * @param[in] Frame       MSDU frame
  *                        IEEE802.15.4 paragraph - 7.1.1.1.1
  * @param[in] Handle      the handle associated with the MSDU to be
@@ -113,7 +173,7 @@ RESULT MACLayer_Init(void);
  * @param[in] TxOptions   the transmission options for this MSDU
  *                        IEEE802.15.4 paragraph - 7.1.1.1.1
  * @return SUCCESS if request successfully accepted
- * @return FAIL    otherwise
+ * @return FAIL    if tx queue is full or radio is off
  **********************************************************************************/
 RESULT MACLayer_DATA_Request(MACLayerFrame *Frame,uint8_t Handle,
                              uint8_t TxOptions);
@@ -121,13 +181,16 @@ RESULT MACLayer_DATA_Request(MACLayerFrame *Frame,uint8_t Handle,
 /*******************************************************************************//**
  * MCPS-DATA.confirm
  * IEEE802.15.4 paragraph - 7.1.1.2
- * @param[in] Handle the handle associated with the MSDU
- *                   being confirmed
- *                   IEEE802.15.4 paragraph - 7.1.1.2.1
- * @param[in] Status the result of the request to transmit a packet
- *                   IEEE802.15.4 paragraph - 7.1.1.2.1
+ * @param[in] Handle    the handle associated with the MSDU
+ *                      being confirmed
+ *                      IEEE802.15.4 paragraph - 7.1.1.2.1
+ * @param[in] Status    the result of the request to transmit a packet
+ *                      IEEE802.15.4 paragraph - 7.1.1.2.1
+ * @param[in] Timestamp SFD time of the last transmission of the frame in micro
+ *                      seconds, 0 if the frame has not been transmitted
+ *                      IEEE802.15.4 paragraph - 7.1.1.2.1
  **********************************************************************************/
-EVENT MACLayer_DATA_Confirm(uint8_t Handle,MAC_ENUM Status);
+EVENT MACLayer_DATA_Confirm(uint8_t Handle,MAC_ENUM Status,uint64_t Timestamp);
 
 /*******************************************************************************//**
  * MCPS-DATA.indication
@@ -147,6 +210,34 @@ EVENT MACLayer_DATA_Confirm(uint8_t Handle,MAC_ENUM Status);
 EVENT MACLayer_DATA_Indication(MACLayerFrame *Frame,uint8_t LinkQuality,
                                BOOL SecurityUse,uint8_t ACLEntry);
 
+/*******************************************************************************//**
+ * MLME-SCAN.request for ED scan
+ * IEEE802.15.4 paragraph - 7.1.11.1
+ * radio is switched to every channel of the mask in turn and its energy is
+ * sampled every MAC_ED_SAMPLE_PERIOD ms, radio stays on the last scanned
+ * channel, frames should not be transmitted during the scan
+ * @param[in] ScanChannels channels to scan, bit n selects channel n
+ *                         IEEE802.15.4 paragraph - 7.1.11.1.1
+ * @param[in] ScanDuration time in milli seconds spent on each channel
+ * @return SUCCESS if request successfully accepted
+ * @return FAIL    if scan is in progress, mask is empty or radio is off
+ **********************************************************************************/
+RESULT MACLayer_ED_SCAN_Request(uint32_t ScanChannels,uint16_t ScanDuration);
+
+/*******************************************************************************//**
+ * MLME-SCAN.confirm for ED scan
+ * IEEE802.15.4 paragraph - 7.1.11.2
+ * @param[in] Status            the result of the scan request
+ *                              IEEE802.15.4 paragraph - 7.1.11.2.1
+ * @param[in] UnscannedChannels requested channels no energy sample was taken on
+ *                              IEEE802.15.4 paragraph - 7.1.11.2.1
+ * @param[in] EnergyDetectList  peak energy level in dBm for every channel of
+ *                              the band, index is channel-MAC_FIRST_CHANNEL
+ *                              IEEE802.15.4 paragraph - 7.1.11.2.1
+ **********************************************************************************/
+EVENT MACLayer_ED_SCAN_Confirm(MAC_ENUM Status,uint32_t UnscannedChannels,
+                               int8_t *EnergyDetectList);
+
 /*******************************************************************************//**
  * returns HW extended MAC address of current device
  * @return HW extended MAC address
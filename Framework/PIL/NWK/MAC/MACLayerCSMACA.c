@@ -10,6 +10,9 @@
 #include "../../PIL/Timers/Timers.h"
 #include "../../PIL/utils.h"
 
+/// unit backoff period in micro seconds, 320 us at 2450 MHz
+#define MAC_UNIT_BACKOFF_PERIOD_US ((PERIOD)MAC_A_UNIT_BACKOFF_PERIOD*PHY_SYMBOL_DURATION)
+
 /// MAC layer frame wich must be transmitted
 typedef struct
 {
@@ -27,6 +30,9 @@ typedef struct
 	
 	/// minBE
 	uint8_t MinBE;
+	
+	/// transceiver transmits loaded frame right after successful CCA
+	BOOL TxOnCCA;
 }MACLayerCSMACADefsStruct;
 static volatile MACLayerCSMACADefsStruct MACLayerCSMACADefs;
 
@@ -44,7 +50,33 @@ EVENT MACLayer_CSMACATimerFired(PARAM Param)
 		MACLayerCSMACADefs.BE = MAC_A_MAX_BE;
 	
 	// perform CCA
-	PHYLayer_CCA_Request();
+	#ifdef PHY_LAYER_HANDLE_CCA_TX
+	if(MACLayerCSMACADefs.TxOnCCA)
+		PHYLayer_CCATX_Request();
+	else
+	#endif
+		PHYLayer_CCA_Request();
+	
+}
+
+/*******************************************************************************//**
+ * waits for random(2^BE-1) unit backoff periods and performs CCA then
+ **********************************************************************************/
+static void MACLayerCSMACA_Backoff(void)
+{
+	PERIOD WaitInterval;
+	
+	// number of periods is uniformly distributed from 0 to 2^BE-1 inclusive
+	WaitInterval  = (PERIOD)Utils_Rand(1<<MACLayerCSMACADefs.BE);
+	WaitInterval *= MAC_UNIT_BACKOFF_PERIOD_US;
+	
+	if(WaitInterval==0)
+	{
+		MACLayer_CSMACATimerFired(NULL);
+		
+	}
+	else
+		Timer_Start(MACLayerCSMACADefs.Timer,TIMER_ONE_SHOT_MODE|TIMER_INTERRUPT_MODE,WaitInterval);
 	
 }
 
@@ -69,25 +101,14 @@ RESULT MACLayerCSMACA_Init(void)
 /*******************************************************************************//**
  * @implements MACLayerCSMACA_Start
  **********************************************************************************/
-void MACLayerCSMACA_Start(void)
+void MACLayerCSMACA_Start(BOOL TxOnCCA)
 {
-	uint32_t WaitInterval;
-	
+	MACLayerCSMACADefs.TxOnCCA = TxOnCCA;
 	MACLayerCSMACADefs.NB = 0;
 	MACLayerCSMACADefs.BE = MACLayerCSMACADefs.MinBE;
 	
-	// start timer
-	WaitInterval = (uint32_t)Utils_Rand( ( (1<<MACLayerCSMACADefs.BE) - 1) );
-	WaitInterval *= MAC_A_UNIT_BACKOFF_PERIOD;
-	WaitInterval = WaitInterval<<4;
-	
-	if(WaitInterval==0)
-	{
-		MACLayer_CSMACATimerFired(NULL);
-		
-	}
-	else
-		Timer_Start(MACLayerCSMACADefs.Timer,TIMER_ONE_SHOT_MODE,WaitInterval);
+	// start backoff
+	MACLayerCSMACA_Backoff();
 	
 }
 
@@ -109,20 +130,8 @@ EVENT PHYLayer_CCA_Confirm(PHY_ENUM Status)
 		// if num tries is less or equal than max backoffs, then try again
 		if(MACLayerCSMACADefs.NB<=MACLayerCSMACADefs.MaxCSMABackoffs)
 		{
-			uint32_t WaitInterval;
-			
-			// start timer
-			WaitInterval = (uint32_t)Utils_Rand( ( (1<<MACLayerCSMACADefs.BE) - 1) );
-			WaitInterval *= MAC_A_UNIT_BACKOFF_PERIOD;
-			WaitInterval = WaitInterval<<4;
-			
-			if(WaitInterval==0)
-			{
-				MACLayer_CSMACATimerFired(NULL);
-				
-			}
-			else
-				Timer_Start(MACLayerCSMACADefs.Timer,TIMER_ONE_SHOT_MODE,WaitInterval);
+			// start backoff
+			MACLayerCSMACA_Backoff();
 			
 		}
 		// else
@@ -18,8 +18,11 @@ RESULT MACLayerCSMACA_Init(void);
 
 /*******************************************************************************//**
  * starts CSMA-CA
+ * @param[in] TxOnCCA if TRUE, CCA is performed by PHYLayer_CCATX_Request, so frame
+ *                    loaded to transceiver is already being sent when CSMA-CA
+ *                    succeeds
  **********************************************************************************/
-void MACLayerCSMACA_Start(void);
+void MACLayerCSMACA_Start(BOOL TxOnCCA);
 
 /*******************************************************************************//**
  * CSMA-CA "done" event
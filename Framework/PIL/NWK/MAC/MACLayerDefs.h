@@ -8,8 +8,28 @@
 #define __MAC_LAYER_DEFS_H__
 
 #include "../../PIL/NWK/PHY/PHYLayer.h"
+#include "../../PIL/NWK/NetBuf.h"
 #include "../../PIL/Defs.h"
 
+/// first octet of MAC frame control field IEEE802.15.4 paragraph - 7.2.1.1
+enum
+{
+	/// frame type mask
+	MAC_FCF_FRAME_TYPE_MASK    = 0x07,
+	/// data frame type
+	MAC_FCF_FRAME_TYPE_DATA    = 0x01,
+	/// ACK frame type
+	MAC_FCF_FRAME_TYPE_ACK     = 0x02,
+	/// security enabled
+	MAC_FCF_SECURITY_ENABLED   = 0x08,
+	/// frame pending
+	MAC_FCF_FRAME_PENDING      = 0x10,
+	/// ACK request
+	MAC_FCF_ACK_REQUEST        = 0x20,
+	/// PAN ID compression (intra PAN)
+	MAC_FCF_PAN_ID_COMPRESSION = 0x40
+};
+
 /// MAC layer states
 typedef enum
 {
@@ -20,7 +40,9 @@ typedef enum
 	/// tx CSMA-CA
 	MAC_LAYER_STATE_TX_CSMA_CA     = 2,
 	/// tx waiting ACK
-	MAC_LAYER_STATE_TX_WAITING_ACK = 3
+	MAC_LAYER_STATE_TX_WAITING_ACK = 3,
+	/// tx frame is being sent
+	MAC_LAYER_STATE_TX_SENDING     = 4
 }MAC_LAYER_STATE;
 
 /// structure defines MAC layer
@@ -49,11 +71,8 @@ typedef struct
 	/// DSN
 	uint8_t DSN;
 	
-	/// tx data
-	uint8_t TxData[PHY_A_MAX_PHY_PACKET_SIZE];
-	
-	/// tx data length
-	uint8_t TxLen;
+	/// frame buffer being transmitted
+	NetBuf *TxBuf;
 }MACLayerDefsStruct;
 
 #endif
@@ -28,43 +28,183 @@
 #define MAC_BROADCAST_ADDR 0xFFFF
 #define NPDU_NWK_Command 0b01000000
 #define NPDU_NWK_Data	0b00000000
-#define MAX_NPDU_SIZE (MAC_A_MAX_MAC_FRAME_SIZE-10)
+#define NWK_HEADER_SIZE 8
+//	 NWK: Frame Control 2 ,   2 ,   2 ,
+//	 1 ,  NSDU 1 .        
+#define MAX_NPDU_SIZE (MAC_A_MAX_MAC_FRAME_SIZE-3-NWK_HEADER_SIZE)
+//	 NSDU   ,    NPDU     
+#define NPDU_NWK_Fragment 0b00000001
+//	    Frame Control,   NWK   :
+//	  1 ,  NSDU 2 ,   2 
+#define NWK_FRAG_HEADER_SIZE 5
+#define NWK_FRAG_PAYLOAD (MAX_NPDU_SIZE-NWK_FRAG_HEADER_SIZE)
+#define NPDU_NWK_Aggregate 0b00000010
+//	    Frame Control, NPDU   NSDU,   
+//	:  NSDU 1 ,   2 
+#define NWK_AGG_RECORD_HEADER 3
+#define NPDU_NWK_Broadcast 0b00000100
+//	    Frame Control,   -  ,   NSDU,
+//	  NWK     1 
+#define NWK_BCAST_HEADER_SIZE 1
 #define aBaseFrameDuration 15
 //	aBaseFrameDuration    ,   15 ms 
+#define NWK_REPAIR_DURATION 1
+//	       aBaseFrameDuration*(2*NWK_REPAIR_DURATION+1) ms
 #define MAC_IEEE_ADDRES_MODE 0x03
 #define MAC_SHORT_ADDRES_MODE 0x02
+#define NWK_EWMA_SHIFT 3
+//	     1/2^NWK_EWMA_SHIFT
 
 MAC_EXTENDED_ADDR HWAddr;
 
 HSocket SocketNWK; 
-HThread JoinThread;          //  
-HThread RouterThread;        //  
+HThread JoinThread=INVALID_HANDLE;          //  
+HThread RouterThread=INVALID_HANDLE;        //  
 PROC RThread(PARAM);
 PROC JThread(PARAM);
 HTimer JoinTimer;            //    Duration
 HTimer HelloTimer;           //    HELLO
-HTimer CheckHello;           //     HELLO
 HTimer NetConfirmTimer;      //  
+HTimer RepairTimer;          //       
+HTimer AggTimer;             //    NSDU
+HTimer BcastTimer;           //     
 EVENT MAC_Init();        //  
 EVENT Stopped();			  //   
+BOOL NWK_IsDescendant(uint16_t A, uint16_t H);  //  
+EVENT NWK_EDScanDone(uint32_t Unscanned, int8_t *Energy);  //   
 BOOL TimerJoinFlag=FALSE;    //    JoinTimer
 BOOL NetInit=FALSE;          //   
-uint8_t ResBuf[MAC_A_MAX_MAC_FRAME_SIZE];      //   
-uint8_t ResLen;              //   
-uint8_t ResLQ;               //    LQI,    
-uint16_t ResAddShort;        //   
-uint64_t ResAddLong;		 // IEEE  
-BOOL ReceiveFlag;            //   
+
+//  
+typedef struct {
+uint8_t Data[MAC_A_MAX_MAC_FRAME_SIZE];  // NPDU
+uint8_t Length;              //  NPDU
+uint8_t LQ;                  //    LQI,    
+int8_t RSSI;                 //    RSSI, dBm
+uint8_t SrcAddrMode;         //   
+uint64_t SrcAddr;            //  ,    
+uint64_t Time;               //   (SFD)
+} NWKRxFrame;
+
+NWKRxFrame RxQueue[NWK_RX_QUEUE_SIZE];  //   
+uint8_t RxHead=0;            //    
+uint8_t RxCount=0;           //    
+uint16_t RxDropCount=0;      //  ,  -     
+uint16_t RadiusDropCount=0;  //  ,  -  
+uint64_t ParentAddLong;      // IEEE  ,     
+uint8_t ParentLQ;            //    
+
+//  NPDU ,    MAC 
+typedef struct {
+EVENT (*TxDone)(BOOL status, uint8_t NsduHandle, uint64_t TxTime);  //  NSDU, NULL   
+uint8_t NsduHandle;          //  NSDU
+uint16_t NextHop;            //   
+BOOL Busy;                   //  
+} NWKDataTx;
+
+NWKDataTx DataTx[MAC_TX_QUEUE_SIZE];  //  ,      
+
+// ,      2^NWK_EWMA_SHIFT,     
+typedef struct {
+uint16_t NetAdd;             //  , 0xFFFF  
+uint64_t LongAdd;            // IEEE , 0  
+uint16_t LQI;                //  LQI
+int16_t RSSI;                //  RSSI
+uint16_t TxRatio;            //    , 255 -   
+uint64_t LastHeard;          //    (SFD)
+BOOL Valid;                  //  
+} NWKNeighbourEntry;
+
+NWKNeighbourEntry Neighbours[NWK_NEIGHBOUR_TABLE_SIZE];  //  
+
+// NSDU,   ,       NWK_TxDone
+typedef struct {
+uint8_t *Data;               // NSDU
+uint16_t Size;               //  NSDU
+uint16_t Offset;             //   
+uint16_t DstAddr;            //  
+uint8_t Tag;                 //  
+uint8_t NsduHandle;          //  NSDU
+EVENT (*TxDone)(BOOL status, uint8_t NsduHandle, uint64_t TxTime);
+uint8_t Pending;             //  ,  
+BOOL Failed;                 //      
+uint64_t Time;               //  SFD   
+BOOL Busy;                   //  
+} NWKFragTx;
+
+NWKFragTx FragTx;
+
+//  NSDU,      ,     
+typedef struct {
+uint8_t Data[NWK_MAX_NSDU_SIZE];  // NSDU
+uint16_t SrcAddr;            //  
+uint8_t Tag;                 //  
+uint16_t Size;               //  NSDU
+uint32_t Mask;               //  
+uint8_t LQ;                  //     
+uint64_t Start;              //     (SFD)
+BOOL Busy;                   //  
+} NWKReasmEntry;
+
+#if NWK_REASSEMBLY_POOL_SIZE>0
+NWKReasmEntry Reasm[NWK_REASSEMBLY_POOL_SIZE];  //  
+#endif
+
+// NSDU,    
+typedef struct {
+uint8_t Data[MAX_NPDU_SIZE]; //  NSDU  
+uint8_t Length;              //  , 0  NSDU 
+uint16_t DstAddr;            //   
+uint8_t Radius;              //     NSDU
+} NWKAggregate;
+
+NWKAggregate Agg;
+BOOL AggTimerFlag=0;         //    
+
+//   ,          
+typedef struct {
+uint16_t SrcAddr;            //  
+uint8_t Seq;                 //  
+uint64_t Time;               //  
+BOOL Valid;                  //  
+} NWKBcastSeen;
+
+NWKBcastSeen BcastSeen[NWK_BCAST_SEEN_SIZE];  //  ,     
+uint8_t BcastSeenHead=0;     //   
+uint8_t BcastSeq=0;          //    
+
+// ,    
+typedef struct {
+uint8_t Data[NWK_HEADER_SIZE+MAX_NPDU_SIZE];  // NPDU
+uint8_t Length;              //  NPDU, 0   
+} NWKBcastTx;
+
+NWKBcastTx BcastTx;
+BOOL BcastTimerFlag=0;       //     
 BOOL NWKProcFlag=0;          //    
 BOOL HelloFiredFlag=0;       //    hello
 BOOL NetBusyFlag=0;          //   .         
 							 //  .
 BOOL NetConfirmTimerFlag=0;  //        	
 BOOL LeaveFlag=0;             //    
-uint8_t CheckHelloFiredFlag=0;  //     Hello   
-uint8_t HelloRSV=0;          //     Hello,  3 -   .
-BOOL HelloRSVFlag=0;          //   Hello
+BOOL RepairFlag=0;           //    ,    
+BOOL RepairTimerFlag=0;      //      
+BOOL RepairFound=0;          //      
+uint16_t RepairAdd;          //    
+uint8_t RepairLQ;            //   ,   
+uint64_t RepairParent;       // IEEE   
+uint8_t HelloExp=0;          //  hello  Hello*2^HelloExp ,     
+uint8_t ParentExp=0;         //   hello ,      
+BOOL HelloSentFlag=0;        // hello       
+BOOL ParentAckFlag=0;        //         
+uint64_t ParentHeard;        //      
+uint32_t HelloRest;          //    hello  , ms
 BOOL SendJoinFlag=0;         //   .
+BOOL ScanFlag=0;             //   ,     
+BOOL ScanStarted=0;          // MAC    
+BOOL ScanDoneFlag=0;         //  
+uint8_t ScanBest=0;          //    , 0      
+BOOL ScanJoin=0;             //         
 uint8_t NWKTxPower=31;   		// ,   
 BOOL DebugFlag=0;
 
@@ -82,36 +222,151 @@ uint8_t Channel;
 uint8_t Duration;
 EVENT (*JDone)(BOOL status, uint16_t NetAdd, uint8_t Hello, uint8_t Module);
 BOOL Coordinator; 
-EVENT (*RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint8_t NsduLength, uint8_t *NsduData,
+EVENT (*RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint16_t NsduLength, uint8_t *NsduData,
 uint8_t LinkQuality,uint64_t RxTime );
 
 };
 struct NWKLayerNodeParam NodeParam;
 
-//   
+//    ,     
+void NWK_WakeThreads(void)
+{
+Thread_Post(JoinThread);
+Thread_Post(RouterThread);
+}
+
+
+
+//  ,             
+uint8_t NWK_Radius(uint16_t DstAddr)
+{
+uint16_t Radius=getdeep(NodeParam.NetAdd,NodeParam.Module)+getdeep(DstAddr,NodeParam.Module);
+
+if (Radius==0) return 1;
+if (Radius>255) return 255;
+return Radius;
+}
+
+
+
+//      IEEE ,  NULL,    
+NWKNeighbourEntry *NWK_NeighbourFind(uint16_t NetAdd, uint64_t LongAdd)
+{
+uint8_t i;
+
+for (i=0;i<NWK_NEIGHBOUR_TABLE_SIZE;i++){
+	if (Neighbours[i].Valid==FALSE) continue;
+	if ((NetAdd!=0xFFFF)&&(Neighbours[i].NetAdd==NetAdd)) return &Neighbours[i];
+	if ((LongAdd!=0)&&(Neighbours[i].LongAdd==LongAdd)) return &Neighbours[i];
+};
+return NULL;
+}
+
+
+
+//    ,        
+//   ,  ,    
+void NWK_NeighbourRx(uint16_t NetAdd, uint64_t LongAdd, uint8_t LQ, int8_t RSSI, uint64_t Time)
+{
+NWKNeighbourEntry *N=NWK_NeighbourFind(NetAdd,LongAdd);
+uint8_t i;
+
+if (N==NULL){
+	N=&Neighbours[0];
+	for (i=0;i<NWK_NEIGHBOUR_TABLE_SIZE;i++){
+		if (Neighbours[i].Valid==FALSE){
+			N=&Neighbours[i];
+			break;
+		};
+		if (Neighbours[i].LastHeard<N->LastHeard) N=&Neighbours[i];
+	};
+	N->NetAdd=NetAdd;
+	N->LongAdd=LongAdd;
+	N->LQI=(uint16_t)LQ<<NWK_EWMA_SHIFT;
+	N->RSSI=(int16_t)RSSI*(1<<NWK_EWMA_SHIFT);
+	N->TxRatio=(uint16_t)255<<NWK_EWMA_SHIFT;
+	N->Valid=TRUE;
+}
+else{
+	N->LQI=N->LQI-(N->LQI>>NWK_EWMA_SHIFT)+LQ;
+	N->RSSI=N->RSSI-(N->RSSI/(1<<NWK_EWMA_SHIFT))+RSSI;
+	if (NetAdd!=0xFFFF) N->NetAdd=NetAdd;
+	if (LongAdd!=0) N->LongAdd=LongAdd;
+};
+N->LastHeard=Time;
+}
+
+
+
+//  hello    ,          IEEE 
+void NWK_NeighbourBind(uint16_t NetAdd, uint64_t LongAdd)
+{
+NWKNeighbourEntry *N=NWK_NeighbourFind(0xFFFF,LongAdd);
+uint8_t i;
+
+if (N==NULL) return;
+for (i=0;i<NWK_NEIGHBOUR_TABLE_SIZE;i++)
+	if ((&Neighbours[i]!=N)&&(Neighbours[i].NetAdd==NetAdd)) Neighbours[i].Valid=FALSE;
+N->NetAdd=NetAdd;
+}
+
+
+
+//   ,      
+void NWK_NeighbourTx(uint16_t NetAdd, MAC_ENUM Status)
+{
+NWKNeighbourEntry *N=NWK_NeighbourFind(NetAdd,0);
+
+if ((N==NULL)||((Status!=MAC_SUCCESS)&&(Status!=MAC_NO_ACK))) return;
+N->TxRatio=N->TxRatio-(N->TxRatio>>NWK_EWMA_SHIFT)+((Status==MAC_SUCCESS)?255:0);
+}
+
+//   ,    ,    
 EVENT DataReceived(uint8_t length, uint8_t *data,uint8_t* Addr, uint8_t SrcAddrMode, uint8_t src_Port, uint8_t LQ)
 { 
+NWKRxFrame *Rx;
 
-ResLen=0;
-
-//    
-while (ResLen!=length){
-ResBuf[ResLen]= data[ResLen];
-ResLen++;
+//  ,  
+if ((RxCount==NWK_RX_QUEUE_SIZE)||(length>sizeof(Rx->Data))){
+	RxDropCount++;
+	return;
 };
 
-// 
-ResLQ=LQ;
+//    
+Rx=&RxQueue[(RxHead+RxCount)%NWK_RX_QUEUE_SIZE];
+memcpy(Rx->Data,data,length);
+Rx->Length=length;
+
+//    
+Rx->LQ=LQ;
+Rx->RSSI=PHYLayer_GetLastRSSI();
+Rx->Time=PHYLayer_GetLastSFDTime();
 
 //         
-if (SrcAddrMode==MAC_SHORT_ADDRES_MODE)  ResAddLong=(*((uint16_t*)(Addr)));
-if (SrcAddrMode==MAC_IEEE_ADDRES_MODE)  ResAddLong=(*((uint64_t*)(Addr)));
+Rx->SrcAddr=0;
+if (SrcAddrMode==MAC_SHORT_ADDRES_MODE)  Rx->SrcAddr=(*((uint16_t*)(Addr)));
+if (SrcAddrMode==MAC_IEEE_ADDRES_MODE)  Rx->SrcAddr=(*((uint64_t*)(Addr)));
+Rx->SrcAddrMode=SrcAddrMode;
 	
-//    
-ReceiveFlag=1;
+RxCount++;
+
+//  ,         
+if (SrcAddrMode==MAC_SHORT_ADDRES_MODE) NWK_NeighbourRx(Rx->SrcAddr,0,LQ,Rx->RSSI,Rx->Time);
+if (SrcAddrMode==MAC_IEEE_ADDRES_MODE) NWK_NeighbourRx(0xFFFF,Rx->SrcAddr,LQ,Rx->RSSI,Rx->Time);
 
 // ,        
  if (DebugFlag==1)LEDs_Toggle(2);
+
+NWK_WakeThreads();
+}
+
+
+
+//     
+void NWK_RxPop(void)
+{
+RxHead=(RxHead+1)%NWK_RX_QUEUE_SIZE;
+RxCount--;
 }
 
 
@@ -122,6 +377,446 @@ EVENT DataTransmitted(RESULT Result)
 // ,        
  if (DebugFlag==1)LEDs_Toggle(1);
 
+//  ,     
+NWK_WakeThreads();
+}
+
+
+
+//  NPDU , MAC      SFD  
+EVENT DataTxConfirm(uint8_t Tag, MAC_ENUM Status, uint64_t Timestamp)
+{
+EVENT (*TxDone)(BOOL status, uint8_t NsduHandle, uint64_t TxTime);
+uint8_t NsduHandle;
+
+if (Tag>=MAC_TX_QUEUE_SIZE) return;
+
+NWK_NeighbourTx(DataTx[Tag].NextHop,Status);
+if ((Status==MAC_SUCCESS)&&(NodeParam.Coordinator!=1)&&(DataTx[Tag].NextHop==getprnt(NodeParam.NetAdd,NodeParam.Module))) ParentAckFlag=1;
+
+//    ,        NSDU
+TxDone=DataTx[Tag].TxDone;
+NsduHandle=DataTx[Tag].NsduHandle;
+DataTx[Tag].Busy=FALSE;
+
+if (TxDone!=NULL) TxDone(Status==MAC_SUCCESS,NsduHandle,Timestamp);
+}
+
+
+
+//  NPDU    ,     
+//        ,      
+RESULT NWK_TxBuf(NetBuf *Buf, uint16_t NextHop, EVENT (*TxDone)(BOOL status, uint8_t NsduHandle, uint64_t TxTime), uint8_t NsduHandle)
+{
+uint64_t SentAdd=NextHop;
+uint8_t Tag;
+
+BEGIN_CRITICAL_SECTION
+{
+	for (Tag=0;Tag<MAC_TX_QUEUE_SIZE;Tag++)
+		if (DataTx[Tag].Busy==FALSE){
+			DataTx[Tag].TxDone=TxDone;
+			DataTx[Tag].NsduHandle=NsduHandle;
+			DataTx[Tag].NextHop=NextHop;
+			DataTx[Tag].Busy=TRUE;
+			break;
+		}
+}
+END_CRITICAL_SECTION
+
+//   ,   
+if (Tag==MAC_TX_QUEUE_SIZE){
+	NetBuf_Free(Buf);
+	return FAIL;
+};
+
+//     ,   
+if (Socket_TxBuf(SocketNWK,Buf,(uint8_t*)&SentAdd,MAC_SHORT_ADDRES_MODE,0,NWKTxPower,DataTxConfirm,Tag)!=SUCCESS){
+	DataTx[Tag].Busy=FALSE;
+	return FAIL;
+};
+return SUCCESS;
+}
+
+
+
+//  ,     
+EVENT FragTxDone(BOOL status, uint8_t NsduHandle, uint64_t TxTime)
+{
+BEGIN_CRITICAL_SECTION
+{
+	FragTx.Pending--;
+}
+END_CRITICAL_SECTION
+
+if (status==FALSE) FragTx.Failed=TRUE;
+FragTx.Time=TxTime;
+NWK_WakeThreads();
+}
+
+
+
+//  ,         ,
+//     MAC    
+void NWK_FragTxSend(void)
+{
+while ((FragTx.Busy==TRUE)&&(FragTx.Failed==FALSE)&&(FragTx.Offset<FragTx.Size)){
+
+	uint16_t Len=FragTx.Size-FragTx.Offset;
+	if (Len>NWK_FRAG_PAYLOAD) Len=NWK_FRAG_PAYLOAD;
+
+	NetBuf *Buf = NetBuf_Alloc();
+	uint8_t *Npdu = (Buf!=NULL)?NetBuf_Put(Buf,NWK_HEADER_SIZE+NWK_FRAG_HEADER_SIZE+Len):NULL;
+	if (Npdu==NULL){
+		NetBuf_Free(Buf);
+		break;
+	};
+
+	Npdu[0]=NPDU_NWK_Data;
+	Npdu[1]=NPDU_NWK_Fragment;
+	*((uint16_t*)(Npdu+2))=FragTx.DstAddr;
+	*((uint16_t*)(Npdu+4))=NodeParam.NetAdd;
+	Npdu[6]=NWK_Radius(FragTx.DstAddr);
+	Npdu[7]=FragTx.NsduHandle;
+	Npdu[NWK_HEADER_SIZE]=FragTx.Tag;
+	*((uint16_t*)(Npdu+NWK_HEADER_SIZE+1))=FragTx.Size;
+	*((uint16_t*)(Npdu+NWK_HEADER_SIZE+3))=FragTx.Offset;
+	memcpy(Npdu+NWK_HEADER_SIZE+NWK_FRAG_HEADER_SIZE,FragTx.Data+FragTx.Offset,Len);
+
+	//       NWK_TxBuf
+	BEGIN_CRITICAL_SECTION
+	{
+		FragTx.Pending++;
+	}
+	END_CRITICAL_SECTION
+
+	if (NWK_TxBuf(Buf,getnext(FragTx.DstAddr,NodeParam.NetAdd,NodeParam.Module),FragTxDone,FragTx.NsduHandle)!=SUCCESS){
+		BEGIN_CRITICAL_SECTION
+		{
+			FragTx.Pending--;
+		}
+		END_CRITICAL_SECTION
+		
+		//  ,   ;      ,
+		//      NWK_Data_Tx, NWK_TxDone  
+		if ((FragTx.Pending==0)&&(FragTx.Offset!=0)) FragTx.Failed=TRUE;
+		break;
+	};
+
+	FragTx.Offset+=Len;
+};
+
+//      ,  
+if ((FragTx.Busy==TRUE)&&(FragTx.Pending==0)&&((FragTx.Failed==TRUE)||(FragTx.Offset>=FragTx.Size))){
+	FragTx.Busy=FALSE;
+	FragTx.TxDone(FragTx.Failed==FALSE,FragTx.NsduHandle,FragTx.Time);
+};
+}
+
+
+
+//  , NSDU  ,    
+//    ,  ,       NWK_REASSEMBLY_TIMEOUT,
+//     ,  
+void NWK_Reassemble(NWKRxFrame *Rx)
+{
+#if NWK_REASSEMBLY_POOL_SIZE==0
+RxDropCount++;
+#else
+uint16_t SrcAddr=*((uint16_t*)(Rx->Data+4));
+uint8_t Tag=Rx->Data[NWK_HEADER_SIZE];
+uint16_t Size=*((uint16_t*)(Rx->Data+NWK_HEADER_SIZE+1));
+uint16_t Offset=*((uint16_t*)(Rx->Data+NWK_HEADER_SIZE+3));
+uint8_t Len=Rx->Length-NWK_HEADER_SIZE-NWK_FRAG_HEADER_SIZE;
+uint8_t Index=Offset/NWK_FRAG_PAYLOAD;
+uint8_t Count=(Size+NWK_FRAG_PAYLOAD-1)/NWK_FRAG_PAYLOAD;
+NWKReasmEntry *R=NULL;
+NWKReasmEntry *Free=NULL;
+uint8_t i;
+
+//   
+if ((Rx->Length<NWK_HEADER_SIZE+NWK_FRAG_HEADER_SIZE)||(Size>NWK_MAX_NSDU_SIZE)||(Offset>=Size)||
+	(Offset%NWK_FRAG_PAYLOAD!=0)||(Count>32)||(Len!=(((Size-Offset)<NWK_FRAG_PAYLOAD)?(Size-Offset):NWK_FRAG_PAYLOAD))){
+	RxDropCount++;
+	return;
+};
+
+for (i=0;i<NWK_REASSEMBLY_POOL_SIZE;i++){
+	BOOL Expired=(Rx->Time-Reasm[i].Start>MS((uint64_t)NWK_REASSEMBLY_TIMEOUT));
+	if ((Reasm[i].Busy==TRUE)&&(Expired==FALSE)&&(Reasm[i].SrcAddr==SrcAddr)&&(Reasm[i].Tag==Tag)&&(Reasm[i].Size==Size)) R=&Reasm[i];
+	else if ((Reasm[i].Busy==FALSE)||(Expired==TRUE)) Free=&Reasm[i];
+};
+
+//   
+if (R==NULL){
+	if (Free==NULL){
+		RxDropCount++;
+		return;
+	};
+	R=Free;
+	R->SrcAddr=SrcAddr;
+	R->Tag=Tag;
+	R->Size=Size;
+	R->Mask=0;
+	R->LQ=Rx->LQ;
+	R->Start=Rx->Time;
+	R->Busy=TRUE;
+};
+
+memcpy(R->Data+Offset,Rx->Data+NWK_HEADER_SIZE+NWK_FRAG_HEADER_SIZE,Len);
+R->Mask|=(uint32_t)1<<Index;
+if (Rx->LQ<R->LQ) R->LQ=Rx->LQ;
+
+//   ,  ,        
+if (R->Mask==((Count==32)?0xFFFFFFFFul:(((uint32_t)1<<Count)-1))){
+	R->Busy=FALSE;
+	NodeParam.RxDone(NodeParam.NetAdd, SrcAddr, Size, R->Data, R->LQ, R->Start);
+};
+#endif
+}
+
+
+
+//   ,  NSDU   
+void NWK_Disaggregate(NWKRxFrame *Rx)
+{
+uint8_t i=NWK_HEADER_SIZE;
+
+while (i+NWK_AGG_RECORD_HEADER<=Rx->Length){
+	uint8_t Len=Rx->Data[i];
+	
+	//     
+	if ((uint16_t)i+NWK_AGG_RECORD_HEADER+Len>Rx->Length){
+		RxDropCount++;
+		return;
+	};
+	NodeParam.RxDone(NodeParam.NetAdd, *((uint16_t*)(Rx->Data+i+1)), Len, Rx->Data+i+NWK_AGG_RECORD_HEADER, Rx->LQ, Rx->Time);
+	i+=NWK_AGG_RECORD_HEADER+Len;
+};
+}
+
+
+
+//   
+EVENT AggFired(PARAM Param)
+{
+AggTimerFlag=1;
+NWK_WakeThreads();
+}
+
+
+
+//   NSDU  ,         
+RESULT NWK_AggFlush(void)
+{
+if (Agg.Length==0) return SUCCESS;
+
+NetBuf *Buf = NetBuf_Alloc();
+uint8_t *Npdu = (Buf!=NULL)?NetBuf_Put(Buf,NWK_HEADER_SIZE+Agg.Length):NULL;
+if (Npdu==NULL){
+	NetBuf_Free(Buf);
+	return FAIL;
+};
+Npdu[0]=NPDU_NWK_Data;
+Npdu[1]=NPDU_NWK_Aggregate;
+*((uint16_t*)(Npdu+2))=Agg.DstAddr;
+*((uint16_t*)(Npdu+4))=NodeParam.NetAdd;
+Npdu[6]=Agg.Radius;
+Npdu[7]=0;
+memcpy(Npdu+NWK_HEADER_SIZE,Agg.Data,Agg.Length);
+
+//     ,       
+if (NWK_TxBuf(Buf,getnext(Agg.DstAddr,NodeParam.NetAdd,NodeParam.Module),NULL,0)!=SUCCESS) return FAIL;
+
+Agg.Length=0;
+AggTimerFlag=0;
+Timer_Destroy(AggTimer);
+return SUCCESS;
+}
+
+
+
+//   ,   :   NSDU    
+BOOL NWK_AggEligible(NWKRxFrame *Rx, uint16_t NextHop)
+{
+if ((NWK_AGGREGATION_WINDOW==0)||(NodeParam.Coordinator==1)) return FALSE;
+if (NextHop!=getprnt(NodeParam.NetAdd,NodeParam.Module)) return FALSE;
+if (Rx->Data[1]==NPDU_NWK_Aggregate) return (Rx->Length-NWK_HEADER_SIZE<=sizeof(Agg.Data));
+return (Rx->Data[1]==0)&&(Rx->Length-NWK_HEADER_SIZE+NWK_AGG_RECORD_HEADER<=sizeof(Agg.Data));
+}
+
+
+
+//     NSDU, FAIL     ,     
+RESULT NWK_Aggregate(NWKRxFrame *Rx)
+{
+uint16_t DstAddr=*((uint16_t*)(Rx->Data+2));
+uint8_t Len=Rx->Length-NWK_HEADER_SIZE;
+uint8_t Radius=Rx->Data[6]-1;
+
+if (Rx->Data[1]!=NPDU_NWK_Aggregate) Len+=NWK_AGG_RECORD_HEADER;
+
+//  NSDU       ,   
+if ((Agg.Length>0)&&((Agg.DstAddr!=DstAddr)||(Agg.Length+Len>sizeof(Agg.Data)))){
+	if (NWK_AggFlush()!=SUCCESS) return FAIL;
+};
+
+//  NSDU  
+if (Agg.Length==0){
+	AggTimer=Timer_Create(AggFired,NULL);
+	if (Timer_Start(AggTimer,TIMER_ONE_SHOT_MODE,MS(NWK_AGGREGATION_WINDOW))!=SUCCESS){
+		Timer_Destroy(AggTimer);
+		return FAIL;
+	};
+	Agg.DstAddr=DstAddr;
+	Agg.Radius=Radius;
+};
+
+//     NSDU,     
+if (Radius<Agg.Radius) Agg.Radius=Radius;
+
+//      ,  NSDU  
+if (Rx->Data[1]==NPDU_NWK_Aggregate) memcpy(Agg.Data+Agg.Length,Rx->Data+NWK_HEADER_SIZE,Len);
+else{
+	Agg.Data[Agg.Length]=Len-NWK_AGG_RECORD_HEADER;
+	memcpy(Agg.Data+Agg.Length+1,Rx->Data+4,2);
+	memcpy(Agg.Data+Agg.Length+NWK_AGG_RECORD_HEADER,Rx->Data+NWK_HEADER_SIZE,Len-NWK_AGG_RECORD_HEADER);
+};
+Agg.Length+=Len;
+return SUCCESS;
+}
+
+
+
+// ,    
+BOOL NWK_BcastSeen(uint16_t SrcAddr, uint8_t Seq)
+{
+uint64_t Time=GetTime();
+uint8_t i;
+
+for (i=0;i<NWK_BCAST_SEEN_SIZE;i++)
+	if ((BcastSeen[i].Valid==TRUE)&&(BcastSeen[i].SrcAddr==SrcAddr)&&(BcastSeen[i].Seq==Seq)&&
+		(Time-BcastSeen[i].Time<=MS((uint64_t)NWK_BCAST_SEEN_TIMEOUT))) return TRUE;
+return FALSE;
+}
+
+
+
+//  
+void NWK_BcastMark(uint16_t SrcAddr, uint8_t Seq)
+{
+BcastSeen[BcastSeenHead].SrcAddr=SrcAddr;
+BcastSeen[BcastSeenHead].Seq=Seq;
+BcastSeen[BcastSeenHead].Time=GetTime();
+BcastSeen[BcastSeenHead].Valid=TRUE;
+BcastSeenHead=(BcastSeenHead+1)%NWK_BCAST_SEEN_SIZE;
+}
+
+
+
+//    
+EVENT BcastFired(PARAM Param)
+{
+BcastTimerFlag=1;
+NWK_WakeThreads();
+}
+
+
+
+//   ,       
+RESULT NWK_BcastFlush(void)
+{
+if (BcastTx.Length==0) return SUCCESS;
+
+NetBuf *Buf = NetBuf_Alloc();
+uint8_t *Npdu = (Buf!=NULL)?NetBuf_Put(Buf,BcastTx.Length):NULL;
+if (Npdu==NULL){
+	NetBuf_Free(Buf);
+	return FAIL;
+};
+memcpy(Npdu,BcastTx.Data,BcastTx.Length);
+if (NWK_TxBuf(Buf,MAC_BROADCAST_ADDR,NULL,0)!=SUCCESS) return FAIL;
+
+BcastTx.Length=0;
+BcastTimerFlag=0;
+Timer_Destroy(BcastTimer);
+return SUCCESS;
+}
+
+
+
+//   
+// NSDU      ,       ,    ,
+//        . FAIL     ,     
+RESULT NWK_BroadcastRx(NWKRxFrame *Rx)
+{
+uint16_t Root=*((uint16_t*)(Rx->Data+2));
+uint16_t SrcAddr=*((uint16_t*)(Rx->Data+4));
+uint8_t Radius=Rx->Data[6];
+uint8_t Seq=Rx->Data[NWK_HEADER_SIZE];
+BOOL Member,Relay;
+
+if ((Rx->Length<NWK_HEADER_SIZE+NWK_BCAST_HEADER_SIZE)||(Rx->Length>sizeof(BcastTx.Data))){
+	RxDropCount++;
+	return SUCCESS;
+};
+
+//    
+if (NWK_BcastSeen(SrcAddr,Seq)==TRUE) return SUCCESS;
+
+Member=NWK_IsDescendant(NodeParam.NetAdd,Root);
+Relay=(Radius>1)&&(NodeParam.K!=0)&&((Member==TRUE)||(NWK_IsDescendant(Root,NodeParam.NetAdd)==TRUE));
+
+//      
+if ((Relay==TRUE)&&(BcastTx.Length!=0)) return FAIL;
+
+NWK_BcastMark(SrcAddr,Seq);
+
+//    ,     
+if (Relay==TRUE){
+	memcpy(BcastTx.Data,Rx->Data,Rx->Length);
+	BcastTx.Data[6]=Radius-1;
+	BcastTx.Length=Rx->Length;
+	BcastTimer=Timer_Create(BcastFired,NULL);
+	if (Timer_Start(BcastTimer,TIMER_ONE_SHOT_MODE,MS(1+Utils_Rand32()%NWK_BCAST_JITTER))!=SUCCESS){
+		Timer_Destroy(BcastTimer);
+		BcastTx.Length=0;
+	};
+};
+
+//     MAC_BROADCAST_ADDR
+if (Member==TRUE) NodeParam.RxDone(MAC_BROADCAST_ADDR, SrcAddr, Rx->Length-NWK_HEADER_SIZE-NWK_BCAST_HEADER_SIZE, Rx->Data+NWK_HEADER_SIZE+NWK_BCAST_HEADER_SIZE, Rx->LQ, Rx->Time);
+return SUCCESS;
+}
+
+
+
+//   After  , 0    
+uint8_t NWK_NextChannel(uint32_t Mask, uint8_t After)
+{
+uint8_t Channel=(After<MAC_FIRST_CHANNEL)?MAC_FIRST_CHANNEL:After+1;
+
+for (;Channel<=MAC_LAST_CHANNEL;Channel++)
+	if (Mask&((uint32_t)1<<Channel)) return Channel;
+return 0;
+}
+
+
+
+//   ,      
+EVENT NWK_EDScanDone(uint32_t Unscanned, int8_t *Energy)
+{
+uint8_t Channel;
+
+if (ScanFlag==0) return;
+
+ScanBest=0;
+for (Channel=MAC_FIRST_CHANNEL;Channel<=MAC_LAST_CHANNEL;Channel++){
+	if (((NWK_SCAN_CHANNELS&~Unscanned)&((uint32_t)1<<Channel))==0) continue;
+	if ((ScanBest==0)||(Energy[Channel-MAC_FIRST_CHANNEL]<Energy[ScanBest-MAC_FIRST_CHANNEL])) ScanBest=Channel;
+};
+ScanDoneFlag=1;
+NWK_WakeThreads();
 }
 
 
@@ -132,7 +827,7 @@ EVENT RequestJoinFired(PARAM Param)
 
 
 TimerJoinFlag=TRUE;
-
+NWK_WakeThreads();
 
 }
 
@@ -141,6 +836,8 @@ EVENT MAC_Init(){
 	
 	SocketNWK = Socket_Create(0,DataTransmitted,DataReceived);
 	
+	//  ,   join
+	NWK_WakeThreads();
 }
 
 //    Hello
@@ -149,17 +846,80 @@ EVENT HelloFired(PARAM Param)
 
 
 HelloFiredFlag=1;
+NWK_WakeThreads();
+
+}
 
+//  hello  ms,    
+uint32_t NWK_HelloPeriod(uint8_t Exp)
+{
+uint32_t Period=(uint32_t)NodeParam.Hello*1000;
+
+while ((Exp>0)&&(Period<=NWK_HELLO_MAX_PERIOD/2)){
+	Period<<=1;
+	Exp--;
+};
+return Period;
 }
 
-//    HELLO
-EVENT CheckHelloFired (PARAM Param)
+
+
+//   hello (Trickle), hello       ,
+//  hello   
+void NWK_HelloInterval(void)
 {
+uint32_t Period=NWK_HelloPeriod(HelloExp);
+uint32_t Half=Period/2;
+uint32_t T=Half;
+
+if (Half>0) T+=Utils_Rand32()%Half;
+HelloRest=Period-T;
+HelloSentFlag=0;
+ParentAckFlag=0;
+Timer_Start(HelloTimer,TIMER_ONE_SHOT_MODE,MS(T));
+}
+
+
 
+//   -    ,  , hello   
+void NWK_HelloReset(void)
+{
+if (HelloExp==0) return;
+HelloExp=0;
+Timer_Stop(HelloTimer);
+NWK_HelloInterval();
+}
 
-CheckHelloFiredFlag=1;
 
 
+//  hello,     ,     hello 
+RESULT NWK_SendHello(void)
+{
+uint8_t Buf[10];
+uint64_t sendadd=MAC_BROADCAST_ADDR;
+
+memset(Buf,0,sizeof(Buf));
+Buf[0]=NPDU_NWK_Command;
+(*((uint16_t*)(Buf+4)))=NodeParam.NetAdd;
+Buf[8]=0x03; // hello ,  .
+Buf[9]=HelloExp;
+return Socket_Tx(SocketNWK,sizeof(Buf),Buf,(uint8_t*)&sendadd,MAC_IEEE_ADDRES_MODE,0,NWKTxPower);
+}
+
+
+
+//       ,   ,    hello
+void NWK_HeardFrom(uint16_t SrcAddr, uint64_t Time)
+{
+if (SrcAddr==NodeParam.NetAdd) return;
+
+if ((NodeParam.Coordinator!=1)&&(getprnt(NodeParam.NetAdd,NodeParam.Module)==SrcAddr)) ParentHeard=Time;
+
+if ((SrcAddr!=0)&&(getprnt(SrcAddr,NodeParam.Module)==NodeParam.NetAdd)){
+	// 
+	uint8_t ncld= SrcAddr-NodeParam.NetAdd*NodeParam.Module;
+	NodeParam.Chld[ncld]=0; // 
+};
 }
 
 //   
@@ -168,11 +928,87 @@ EVENT NetConfirmFired  (PARAM Param)
 
 
 NetConfirmTimerFlag=1;
+NWK_WakeThreads();
 
 
 }
 
 
+//     
+EVENT RepairFired  (PARAM Param)
+{
+RepairTimerFlag=1;
+NWK_WakeThreads();
+}
+
+
+
+//    A   H,    ,   
+BOOL NWK_IsDescendant(uint16_t A, uint16_t H)
+{
+while (A>H) A=getprnt(A,NodeParam.Module);
+return (A==H);
+}
+
+
+
+//    ,      ,
+//      
+RESULT NWK_StartRepair(void)
+{
+uint8_t Buf[9];
+uint64_t sendadd=MAC_BROADCAST_ADDR;
+
+if (RepairFlag==1) return SUCCESS;
+
+memset(Buf,0,sizeof(Buf));
+Buf[0]=NPDU_NWK_Command;
+Buf[8]=0x01;  // join
+if (Socket_Tx(SocketNWK,sizeof(Buf),Buf,(uint8_t*)&sendadd,MAC_IEEE_ADDRES_MODE,0,NWKTxPower)!=SUCCESS) return FAIL;
+
+RepairTimer = Timer_Create(RepairFired,NULL);
+if (Timer_Start(RepairTimer,TIMER_ONE_SHOT_MODE,MS(aBaseFrameDuration * (2*NWK_REPAIR_DURATION + 1)))!=SUCCESS){
+	Timer_Destroy(RepairTimer);
+	return FAIL;
+};
+
+RepairFlag=1;
+RepairFound=0;
+RepairLQ=0;
+return SUCCESS;
+}
+
+
+
+//   ,   ,     
+//   rebase 0x06,       
+void NWK_ChangeAddr(uint16_t NewAdd)
+{
+uint8_t Buf[13];
+uint64_t sendadd=MAC_BROADCAST_ADDR;
+uint16_t OldAdd=NodeParam.NetAdd;
+
+NodeParam.NetAdd=NewAdd;
+NWK_SetParams(NewAdd, MAC_SHORT_ADDRES_MODE, NodeParam.PANID, NodeParam.Channel);
+ParentHeard=GetTime();
+ParentExp=0;
+NWK_HelloReset();
+
+//  
+NodeParam.JDone(3,NodeParam.NetAdd,NodeParam.Hello,NodeParam.Module);
+
+if (NodeParam.K==0) return;
+
+memset(Buf,0,sizeof(Buf));
+Buf[0]=NPDU_NWK_Command;
+*((uint16_t*)(Buf+4))=NewAdd;
+Buf[8]=0x06;  // rebase
+*((uint16_t*)(Buf+9))=OldAdd;
+*((uint16_t*)(Buf+11))=NewAdd;
+Socket_Tx(SocketNWK,sizeof(Buf),Buf,(uint8_t*)&sendadd,MAC_IEEE_ADDRES_MODE,0,NWKTxPower);
+}
+
+
 
 
 
@@ -188,6 +1024,22 @@ NetConfirmTimerFlag=1;
 
 PROC JThread( PARAM Param){
 
+//      ,      ,
+// join     ,    
+if ((TimerJoinFlag==TRUE)&&(NodeParam.NN==0)&&(ScanJoin==1)&&(NWK_NextChannel(NWK_SCAN_CHANNELS,NodeParam.Channel)!=0)){
+
+	TimerJoinFlag=FALSE;
+	while (RxCount!=0) NWK_RxPop();
+	
+	NodeParam.Channel=NWK_NextChannel(NWK_SCAN_CHANNELS,NodeParam.Channel);
+	NWK_SetParams(HWAddr,MAC_IEEE_ADDRES_MODE,NodeParam.PANID,NodeParam.Channel);
+	
+	SendJoinFlag=0;
+	Timer_Start(JoinTimer,TIMER_ONE_SHOT_MODE,MS(aBaseFrameDuration * (2*NodeParam.Duration + 1)));
+	Thread_Post(JoinThread);
+	return;
+};
+
 if (SendJoinFlag==0){
 
 	//  Join
@@ -215,28 +1067,34 @@ if (SendJoinFlag==0){
 	
 	
 };
-//   
-if (ReceiveFlag==1){
-ReceiveFlag=0;
+//    
+while (RxCount!=0){
+	NWKRxFrame *Rx=&RxQueue[RxHead];
  					  	
 	//       (   )  .
 	// ,    .
-	if (ResBuf[0]==NPDU_NWK_Command){
-				ReceiveFlag=0;
+	if (Rx->Data[0]==NPDU_NWK_Command){
 
-		// reply 0x02    . 	
-			if (ResBuf[8]==0x02) {
+		// reply 0x02    ,     
+			if ((Rx->Data[8]==0x02)&&(NodeParam.NN+4<=127)) {
 			
 				//       ,       
 				
-				NodeParam.NetTbl[NodeParam.NN]=*((uint16_t*)(ResBuf+9));  // 
+				NodeParam.NetTbl[NodeParam.NN]=*((uint16_t*)(Rx->Data+9));  // 
 				NodeParam.NN++;
-				NodeParam.NetTbl[NodeParam.NN]=*((uint16_t*)(ResBuf+11)); // 
+				NodeParam.NetTbl[NodeParam.NN]=*((uint16_t*)(Rx->Data+11)); // 
 				NodeParam.NN++;
-				NodeParam.NetTbl[NodeParam.NN]=*((uint16_t*)(ResBuf+13));  //  hello
+				NodeParam.NetTbl[NodeParam.NN]=*((uint16_t*)(Rx->Data+13));  //  hello
 				NodeParam.NN++;
-				NodeParam.NetTbl[NodeParam.NN]=ResLQ;      //  
+				NodeParam.NetTbl[NodeParam.NN]=Rx->LQ;      //  
 				NodeParam.NN++;
+				
+				//       ,
+				//     ,     
+				if (Rx->LQ>=ParentLQ){
+					ParentLQ=Rx->LQ;
+					ParentAddLong=Rx->SrcAddr;
+				};
 			
 			};
 			
@@ -245,6 +1103,7 @@ ReceiveFlag=0;
 			
 		};
 	
+	NWK_RxPop();
 
 };
 
@@ -281,11 +1140,14 @@ if (TimerJoinFlag==TRUE){
 		
 		//   	
 		RouterThread = Thread_Create(RThread,NULL);
-		Thread_Start(RouterThread,THREAD_PROCESS_MODE);	
+		Thread_Start(RouterThread,THREAD_EVENT_MODE|THREAD_PRIORITY_HIGH);	
 	
-		//  ,   Hello
-		CheckHello = Timer_Create (CheckHelloFired,NULL);  
-		Timer_Start(CheckHello,TIMER_CYCLIC_MODE,MS(NodeParam.Hello*1000));
+		//   hello,    
+		ParentHeard=GetTime();
+		ParentExp=0;
+		HelloExp=0;
+		HelloTimer = Timer_Create (HelloFired,NULL);  
+		NWK_HelloInterval();
 
 	
 	//  
@@ -297,7 +1159,7 @@ if (TimerJoinFlag==TRUE){
 		(*((uint16_t*)(Buf+4)))=NodeParam.NetAdd;
 		Buf[8]=0x04; //  ack . 
 		
-		Socket_Tx(SocketNWK,len,Buf,(uint8_t *)&ResAddLong,MAC_IEEE_ADDRES_MODE,0,NWKTxPower);	
+		Socket_Tx(SocketNWK,len,Buf,(uint8_t *)&ParentAddLong,MAC_IEEE_ADDRES_MODE,0,NWKTxPower);	
 		//    
 		NWK_SetParams(NodeParam.NetAdd, MAC_SHORT_ADDRES_MODE, NodeParam.PANID, NodeParam.Channel);
 	
@@ -336,6 +1198,20 @@ if (TimerJoinFlag==TRUE){
 
 PROC RThread(PARAM Param){
 
+//   ,        hello  
+if (ScanFlag==1){
+
+	//     ,      
+	if ((ScanStarted==0)&&(MACLayer_ED_SCAN_Request(NWK_SCAN_CHANNELS,NWK_SCAN_DURATION)==SUCCESS)) ScanStarted=1;
+	while (RxCount!=0) NWK_RxPop();
+	if (ScanDoneFlag==0) return;
+	
+	ScanFlag=0;
+	if (ScanBest!=0) NodeParam.Channel=ScanBest;
+	NWK_SetParams(0,MAC_SHORT_ADDRES_MODE,NodeParam.PANID,NodeParam.Channel);
+	NWK_HelloInterval();
+};
+
 if (NetConfirmTimerFlag==1){
 
 //       
@@ -345,46 +1221,115 @@ if (NetConfirmTimerFlag==1){
 
 };
 
-//    
+//     
+if (RepairTimerFlag==1){
+
+	RepairTimerFlag=0;
+	RepairFlag=0;
+	Timer_Destroy(RepairTimer);
+
+	if (RepairFound==1){
+		//        
+		NWK_ChangeAddr(RepairAdd);
+
+		uint8_t Buf[9];
+		memset(Buf,0,sizeof(Buf));
+		Buf[0]=NPDU_NWK_Command;
+		(*((uint16_t*)(Buf+4)))=NodeParam.NetAdd;
+		Buf[8]=0x04; //  ack .
+		Socket_Tx(SocketNWK,sizeof(Buf),Buf,(uint8_t *)&RepairParent,MAC_IEEE_ADDRES_MODE,0,NWKTxPower);
+	}
+	//   ,   
+	else LeaveFlag=1;
+
+};
+
+//   ,  NSDU  
+if (AggTimerFlag==1) NWK_AggFlush();
+
+//     
+if (BcastTimerFlag==1) NWK_BcastFlush();
 
-if (ReceiveFlag==1){
+//   
+NWK_FragTxSend();
+
+//     
+
+while (RxCount!=0){
+	NWKRxFrame *Rx=&RxQueue[RxHead];
+	
+	//     
+	if (Rx->SrcAddrMode==MAC_SHORT_ADDRES_MODE) NWK_HeardFrom(Rx->SrcAddr,Rx->Time);
+	
+	//     NWK 
+	if ((Rx->Data[0]==NPDU_NWK_Data)&&(Rx->Length<NWK_HEADER_SIZE)){
+		RxDropCount++;
+		NWK_RxPop();
+		continue;
+	};
+	
 	//    
-	if (ResBuf[0]==0){
+	if (Rx->Data[0]==0){
 	
 	//  
 		if (DebugFlag==1)LEDs_Toggle(4);
 	
-		ReceiveFlag=0;
-		uint16_t DstAddr = *((uint16_t*)(ResBuf+2));
+		uint16_t DstAddr = *((uint16_t*)(Rx->Data+2));
+		
+		//      
+		if (Rx->Data[1]&NPDU_NWK_Broadcast){
+			if (NWK_BroadcastRx(Rx)!=SUCCESS)
+				break;
+		}
+		
+		//      ,     
+		else if ((DstAddr==NodeParam.NetAdd)&&(Rx->Data[1]&NPDU_NWK_Fragment)) NWK_Reassemble(Rx);
+		
+		//       
+		else if ((DstAddr==NodeParam.NetAdd)&&(Rx->Data[1]&NPDU_NWK_Aggregate)) NWK_Disaggregate(Rx);
 		
 		//      
-		if (DstAddr==NodeParam.NetAdd){
+		else if (DstAddr==NodeParam.NetAdd){
 		
-			uint16_t SrcAddr = *((uint16_t*)(ResBuf+4));
-			uint8_t NsduLength = ResLen-7;
-			uint8_t LinkQuality = ResLQ;
-			uint64_t RxTime = GetTime();
+			uint16_t SrcAddr = *((uint16_t*)(Rx->Data+4));
+			uint8_t NsduLength = Rx->Length-NWK_HEADER_SIZE;
+			uint8_t LinkQuality = Rx->LQ;
+			uint64_t RxTime = Rx->Time;
 		
 		//     	
-			NodeParam.RxDone(DstAddr, SrcAddr, NsduLength, ResBuf+7,LinkQuality,RxTime );
+			NodeParam.RxDone(DstAddr, SrcAddr, NsduLength, Rx->Data+NWK_HEADER_SIZE,LinkQuality,RxTime );
 		
 		};
 		
 		//      ,    
-		if (DstAddr!=NodeParam.NetAdd){
+		if ((DstAddr!=NodeParam.NetAdd)&&((Rx->Data[1]&NPDU_NWK_Broadcast)==0)){
 			
 			//   next hop
-//			uint16_t nextAddr = getnext(DstAddr,NodeParam.NetAdd,NodeParam.Module);
-			uint64_t SentAdd;
+			uint16_t SentAdd;
 			SentAdd=getnext(DstAddr,NodeParam.NetAdd, NodeParam.Module);
 
-			/*    1,     ,     
-			uint8_t Radius=ResBuf[5];
-			Radius--;
-			ResBuf[5]=Radius;
-			 R>0  
-			*/
-			Socket_Tx(SocketNWK,ResLen,ResBuf,(uint8_t*)&SentAdd,MAC_SHORT_ADDRES_MODE, 0,NWKTxPower);
+			//  :  ,  -  ,  
+			if (Rx->Data[6]<=1) RadiusDropCount++;
+
+			//    ,       ,
+			//      
+			//             NSDU
+			else if (NWK_AggEligible(Rx,SentAdd)==TRUE){
+				if (NWK_Aggregate(Rx)!=SUCCESS)
+					break;
+			}
+			else{
+				NetBuf *Buf = NetBuf_Alloc();
+				uint8_t *Npdu = (Buf!=NULL)?NetBuf_Put(Buf,Rx->Length):NULL;
+				if (Npdu==NULL){
+					NetBuf_Free(Buf);
+					break;
+				};
+				memcpy(Npdu,Rx->Data,Rx->Length);
+				Npdu[6]--;  //    ,      
+				if (NWK_TxBuf(Buf,SentAdd,NULL,0)!=SUCCESS)
+					break;
+			};
 			
 			
 		
@@ -397,23 +1342,21 @@ if (ReceiveFlag==1){
 
 	//   
 	
-	if (ResBuf[0]==NPDU_NWK_Command){
-		//    . 
+	if (Rx->Data[0]==NPDU_NWK_Command){
 		/*      ,   , 
 		        . 
 		*/
-		ReceiveFlag=0;
 		
 		//    
-		uint16_t SrcAddr = *((uint16_t*)(ResBuf+4));	
+		uint16_t SrcAddr = *((uint16_t*)(Rx->Data+4));	
 
 		//    join
-			if (ResBuf[8]==0x01) {
+			if (Rx->Data[8]==0x01) {
 			
 			
 		//            
 
-				if ((NodeParam.NetAdd!=-1)&&((NodeParam.K+1)<NodeParam.Module)&&(NetBusyFlag==0)){			
+				if ((NodeParam.NetAdd!=-1)&&((NodeParam.K+1)<NodeParam.Module)&&(NetBusyFlag==0)&&(RepairFlag==0)){			
 				  
 					//     
 					if ((NodeParam.NetAdd*NodeParam.Module + NodeParam.K + 1)<=65535){
@@ -432,11 +1375,7 @@ if (ReceiveFlag==1){
 						NetBusyFlag=1;  //    
 						// 	
 						uint8_t Buf[127]; 
-						 i=0;
-						while (i!=127){
-							Buf[i]=0;
-							i++;
-							};
+						memset(Buf,0,sizeof(Buf));
 						uint8_t len=0;
  
 						//Frame Control 2 octets
@@ -456,7 +1395,7 @@ if (ReceiveFlag==1){
 				
 						len=15;
 						uint64_t SentAdd;
-						SentAdd=ResAddLong;
+						SentAdd=Rx->SrcAddr;
 						Socket_Tx(SocketNWK,len,Buf,(uint8_t*)&SentAdd,MAC_IEEE_ADDRES_MODE, 0,NWKTxPower);	
 						
 						//     .        
@@ -473,27 +1412,68 @@ if (ReceiveFlag==1){
 		};
 		//   hello    .
 		//   
-		if (ResBuf[8]==0x03) {
+		if (Rx->Data[8]==0x03) {
 				
+				// hello   IEEE ,    
+				if (Rx->SrcAddrMode==MAC_IEEE_ADDRES_MODE) NWK_NeighbourBind(SrcAddr,Rx->SrcAddr);
 				
-					//   hello  
-			
-				if (getprnt(NodeParam.NetAdd,NodeParam.Module)==SrcAddr){
+				NWK_HeardFrom(SrcAddr,Rx->Time);
 				
-					HelloRSVFlag=1;
-				};
-					//hello  
-				if (getprnt(ResAddShort,NodeParam.Module)==NodeParam.NetAdd)	{
-					// 
-					uint8_t ncld= ResAddShort-NodeParam.NetAdd*NodeParam.Module;
-					NodeParam.Chld[ncld]=0; // 
-
+					//hello  ,        
+				if ((NodeParam.Coordinator!=1)&&(getprnt(NodeParam.NetAdd,NodeParam.Module)==SrcAddr)){
+				
+					ParentExp=(Rx->Length>9)?Rx->Data[9]:0;
+					if (HelloExp>ParentExp){
+						HelloExp=ParentExp;
+						Timer_Stop(HelloTimer);
+						NWK_HelloInterval();
 					};
+				};
 			
 			};	
 		
+		//         
+		if ((Rx->Data[8]==0x02)&&(RepairFlag==1)) {
+				
+				uint16_t Offer=*((uint16_t*)(Rx->Data+9));
+				uint16_t Prnt=getprnt(Offer,NodeParam.Module);
+				uint8_t LQ=Rx->LQ;
+				
+				//     ,       
+				NWKNeighbourEntry *N=NWK_NeighbourFind(0xFFFF,Rx->SrcAddr);
+				if (N!=NULL) LQ=N->LQI>>NWK_EWMA_SHIFT;
+				
+				//       ,    
+				if ((*((uint16_t*)(Rx->Data+11))==NodeParam.Module)&&
+					(Prnt!=getprnt(NodeParam.NetAdd,NodeParam.Module))&&
+					(NWK_IsDescendant(Prnt,NodeParam.NetAdd)==FALSE)&&
+					((RepairFound==0)||(LQ>=RepairLQ))){
+					RepairFound=1;
+					RepairLQ=LQ;
+					RepairAdd=Offer;
+					RepairParent=Rx->SrcAddr;
+				};
+				
+			};
+		
+		//   ,        
+		if ((Rx->Data[8]==0x06)&&(NodeParam.Coordinator!=1)) {
+				
+				uint16_t OldPrnt=*((uint16_t*)(Rx->Data+9));
+				uint16_t NewPrnt=*((uint16_t*)(Rx->Data+11));
+				
+				if ((OldPrnt!=NewPrnt)&&(getprnt(NodeParam.NetAdd,NodeParam.Module)==OldPrnt)){
+					uint32_t NewAdd=(uint32_t)NewPrnt*NodeParam.Module+(NodeParam.NetAdd-OldPrnt*NodeParam.Module);
+					
+					//     ,   
+					if (NewAdd<0xFFFF) NWK_ChangeAddr(NewAdd);
+					else LeaveFlag=1;
+				};
+				
+			};
+		
 		//      
-		if (ResBuf[8]==0x04) {
+		if (Rx->Data[8]==0x04) {
 			
 				//  
 				//  
@@ -502,13 +1482,15 @@ if (ReceiveFlag==1){
 				if (ncld>=NodeParam.K) {
 				NodeParam.K++;
 				};
+				//  , hello   
+				NWK_HelloReset();
 				NodeParam.Chld[ncld]=0;
 				NetBusyFlag=0;
 		
 			};
 			
 		//      ,  leave	
-		if (ResBuf[8]==0x05) {
+		if (Rx->Data[8]==0x05) {
 				
 				
 					//     
@@ -524,98 +1506,50 @@ if (ReceiveFlag==1){
 
 	};	
 
+	NWK_RxPop();
+
 };
 
 
 
 // hello
-//   -          .
-if ((HelloFiredFlag==1)&&(NodeParam.Coordinator==1)){
-  
-	// 	
-	uint8_t Buf[MAC_A_MAX_MAC_FRAME_SIZE]; 
-	uint8_t i=0;
-	while (i!=127){
-			Buf[i]=0;
-			i++;
-	};
-	
-	(*((uint16_t*)(Buf+4)))=NodeParam.NetAdd;
- 	Buf[0]=NPDU_NWK_Command; 
-	Buf[8]=0x03; // hello ,  . 
-	uint8_t len=9;
-	uint64_t sendadd=MAC_BROADCAST_ADDR;
+//      hello,     
+if (HelloFiredFlag==1){
 
-	if  (Socket_Tx(SocketNWK,len,Buf,(uint8_t *)&sendadd,MAC_IEEE_ADDRES_MODE, 0,NWKTxPower)==SUCCESS) HelloFiredFlag=0;
-
-
-//   
-	i=0;
-	while (i<=NodeParam.K){
+	HelloFiredFlag=0;
 	
-	NodeParam.Chld[i]++;
+	if (HelloSentFlag==0){
 	
-	i++;
-	};
-
-
-	
-};
-//    Hello
-//       
-if ((CheckHelloFiredFlag==1) &&(NodeParam.Coordinator!=1)){
-
-//    
-	CheckHelloFiredFlag=0; 
-	if (HelloRSVFlag==0){
-	// 
-		HelloRSV++; 
-		if(HelloRSV>=3){
-		//  , . 
-		HelloRSV=0;
-		NWK_Leave();
+		HelloSentFlag=1;
 		
+		//     ,  ,   
+		if ((NodeParam.Coordinator!=1)&&(GetTime()-ParentHeard>3*MS((uint64_t)NWK_HelloPeriod(ParentExp)))){
+			ParentHeard=GetTime();
+			if (NWK_StartRepair()!=SUCCESS) LeaveFlag=1;
+			NWK_HelloReset();
 		};
-	};
-	if (HelloRSVFlag==1){
-	//  
-	HelloRSVFlag=0;  
-	//     
-		HelloRSV=0;         
-	
-
-	// 	
-	uint8_t Buf[MAC_A_MAX_MAC_FRAME_SIZE]; 
-	uint8_t i=0;
-	while (i!=127){
-			Buf[i]=0;
-			i++;
-	};
-	
-
-	
-	Buf[0]=NPDU_NWK_Command; 
-	(*((uint16_t*)(Buf+4)))=NodeParam.NetAdd;
-	Buf[8]=0x03; 
- 
-	uint8_t len=9;
-	// hello ,  .
-	uint64_t sendadd=MAC_BROADCAST_ADDR;
-	Socket_Tx(SocketNWK,len,Buf,(uint8_t*)&sendadd,MAC_IEEE_ADDRES_MODE, 0,NWKTxPower);
-	
-	//   
-	i=0;
-	while (i<=NodeParam.K){
-	
-	NodeParam.Chld[i]++;
-	
-	i++;
-	};
-
-
-	
-	
+		
+		//   hello   ,   ,       
+		if ((NodeParam.Coordinator==1)||(NodeParam.K!=0)||(ParentAckFlag==0)) NWK_SendHello();
+		
+		//   , ,  4 ,  
+		uint8_t i=0;
+		while (i<=NodeParam.K){
+		
+		if (NodeParam.Chld[i]<255) NodeParam.Chld[i]++;
+		if ((i!=0)&&(NodeParam.Chld[i]==4)) NWK_HelloReset();
+		
+		i++;
+		};
+		
+		if (HelloSentFlag==1) Timer_Start(HelloTimer,TIMER_ONE_SHOT_MODE,MS(HelloRest));
+	}
+	else{
 	
+		//     
+		if (HelloExp<NWK_HELLO_MAX_EXP) HelloExp++;
+		if ((NodeParam.Coordinator!=1)&&(HelloExp>ParentExp)) HelloExp=ParentExp;
+		NWK_HelloInterval();
 	};
 };
 
@@ -648,14 +1582,17 @@ if (NWK_Leave()==SUCCESS) LeaveFlag=0;
 
 uint8_t NWK_Join(uint16_t PANID, uint8_t Channel,uint8_t Duration,
 EVENT (*JDone)(uint8_t status, uint16_t NetAdd, uint8_t Hello, uint8_t Module),
-EVENT (*NWK_RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint8_t NsduLength, uint8_t *NsduData,
+EVENT (*NWK_RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint16_t NsduLength, uint8_t *NsduData,
 uint8_t LinkQuality,uint64_t RxTime ))
 {
 // Duration - 0x00-0x0e
 //The time spent scanning each channel is
 //(aBaseFrameDuration * (2*Duration + 1))
 	
-	if ((Channel<12)||(Channel>27)) return 0x02;
+	//  0 -         NWK_SCAN_CHANNELS
+	ScanJoin=(Channel==0);
+	if (Channel==0) Channel=NWK_NextChannel(NWK_SCAN_CHANNELS,0);
+	if ((Channel<MAC_FIRST_CHANNEL)||(Channel>MAC_LAST_CHANNEL)) return 0x02;
 	if ((Duration<0)||(Duration>14)) return 0x02;
 	if (NWK_RxDone==0) return 0x02;
 	if (JDone==0) return 0x02;
@@ -665,12 +1602,24 @@ uint8_t LinkQuality,uint64_t RxTime ))
 							 //  .
 	NetConfirmTimerFlag=0; 	
 	LeaveFlag=0;           //    
-	CheckHelloFiredFlag=0;   
-	HelloRSV=0;          //     Hello,  3 -   .
-	HelloRSVFlag=0;          //   Hello
+	HelloFiredFlag=0;
+	HelloExp=0;
 	SendJoinFlag=FALSE;         //  join
 	
 	TimerJoinFlag=0;
+	RxCount=0;                 //    
+	ParentLQ=0;
+	#if NWK_REASSEMBLY_POOL_SIZE>0
+	memset(Reasm,0,sizeof(Reasm));  //   
+	#endif
+	Agg.Length=0;              //   
+	AggTimerFlag=0;
+	BcastTx.Length=0;          //   
+	BcastTimerFlag=0;
+	memset(BcastSeen,0,sizeof(BcastSeen));
+	RepairFlag=0;
+	RepairTimerFlag=0;
+	memset(Neighbours,0,sizeof(Neighbours));  //   
 
 
 	//  
@@ -723,7 +1672,7 @@ uint8_t LinkQuality,uint64_t RxTime ))
    	if (NWKProcFlag==1) return 0x04;
 	NWKProcFlag=1;
 	JoinThread = Thread_Create(JThread,NULL);
-	Thread_Start(JoinThread,THREAD_PROCESS_MODE);
+	Thread_Start(JoinThread,THREAD_EVENT_MODE|THREAD_PRIORITY_HIGH);
 
 	
 	// ,    . 
@@ -749,10 +1698,14 @@ uint8_t LinkQuality,uint64_t RxTime ))
 ///////////////////////////////////////////////////////////////
 
 uint8_t NWK_StartCrd(uint16_t PANID,uint8_t Channel,uint8_t HelloInterval,uint8_t Module,
-EVENT (*NWK_RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint8_t NsduLength, uint8_t *NsduData,
+EVENT (*NWK_RxDone)(uint16_t DstAddr, uint16_t SrcAddr, uint16_t NsduLength, uint8_t *NsduData,
 uint8_t LinkQuality,uint64_t RxTime )){
 	
-	if ((Channel<12)||(Channel>27)) return 0x02;
+	//  0 -       NWK_SCAN_CHANNELS,
+	//       
+	BOOL Scan=(Channel==0);
+	if (Channel==0) Channel=NWK_NextChannel(NWK_SCAN_CHANNELS,0);
+	if ((Channel<MAC_FIRST_CHANNEL)||(Channel>MAC_LAST_CHANNEL)) return 0x02;
 	if (HelloInterval==0) return 0x02;
 	if (Module==0) return 0x02;
 	if (NWK_RxDone==0) return 0x02;
@@ -763,9 +1716,8 @@ uint8_t LinkQuality,uint64_t RxTime )){
 							 //  .
 	NetConfirmTimerFlag=0; 	
 	LeaveFlag=0;           //    
-	CheckHelloFiredFlag=0;   
-	HelloRSV=0;          //     Hello,  3 -   .
-	HelloRSVFlag=0;          //   Hello
+	HelloFiredFlag=0;
+	HelloExp=0;
 	SendJoinFlag=0;         //   .
 	//   
 		uint16_t j;
@@ -786,6 +1738,8 @@ uint8_t LinkQuality,uint64_t RxTime )){
 	NodeParam.Module=Module;
     NodeParam.Hello=HelloInterval;
 	NodeParam.RxDone=NWK_RxDone;
+	NodeParam.Channel=Channel;
+	NodeParam.PANID=PANID;
 	
 	//    
 	if (NWK_SetParams(HWAddr,MAC_IEEE_ADDRES_MODE, PANID,Channel)!=TRUE){
@@ -805,13 +1759,25 @@ uint8_t LinkQuality,uint64_t RxTime )){
 
 	if (NWKProcFlag==1) return 0x04;
 	NWKProcFlag=1;
+	ScanFlag=Scan;
+	ScanStarted=0;
+	ScanDoneFlag=0;
 	RouterThread = Thread_Create(RThread,NULL);
-	Thread_Start(RouterThread,THREAD_PROCESS_MODE);
-	ReceiveFlag=0;
+	Thread_Start(RouterThread,THREAD_EVENT_MODE|THREAD_PRIORITY_HIGH);
+	RxCount=0;
+	memset(Neighbours,0,sizeof(Neighbours));
+	#if NWK_REASSEMBLY_POOL_SIZE>0
+	memset(Reasm,0,sizeof(Reasm));
+	#endif
+	Agg.Length=0;
+	AggTimerFlag=0;
+	BcastTx.Length=0;
+	BcastTimerFlag=0;
+	memset(BcastSeen,0,sizeof(BcastSeen));
 	NodeParam.NetAdd=0; // ,   ,     0
 		                //   
 	HelloTimer = Timer_Create (HelloFired,NULL);  
-	Timer_Start(HelloTimer,TIMER_CYCLIC_MODE,MS(HelloInterval*1000));
+	if (ScanFlag==0) NWK_HelloInterval();
 
 	return 0x01;
 
@@ -819,56 +1785,135 @@ uint8_t LinkQuality,uint64_t RxTime )){
 
 //   
 
-RESULT NWK_Data_Tx(uint16_t DstAddr, uint8_t NsduLength, uint8_t NsduHandle, uint8_t *NsduData, 
+RESULT NWK_Data_Tx(uint16_t DstAddr, uint16_t NsduLength, uint8_t NsduHandle, uint8_t *NsduData, 
 EVENT (*NWK_TxDone)(BOOL status, uint8_t NsduHandle, uint64_t TxTime)){
 	
-	if ((NsduLength>MAX_NPDU_SIZE)&&(NsduLength==0)) return FAIL;
+	if ((NsduLength>NWK_MAX_NSDU_SIZE)||(NsduLength==0)) return FAIL;
     if (NWK_TxDone==0) return FAIL;
 	//  (Radius==0) return Radius=1;
 	if (Thread_IsActive(RouterThread)==0) return FAIL;
 
-	// 	
-	uint8_t Buf[127]; 
-	uint8_t i=0;
-		while (i!=127){
-			Buf[i]=0;
-				i++;
+	// NSDU    ,   ,     NSDU
+	if (NsduLength>MAX_NPDU_SIZE){
+		if (FragTx.Busy==TRUE) return FAIL;
+		FragTx.Data=NsduData;
+		FragTx.Size=NsduLength;
+		FragTx.Offset=0;
+		FragTx.DstAddr=DstAddr;
+		FragTx.Tag++;
+		FragTx.NsduHandle=NsduHandle;
+		FragTx.TxDone=NWK_TxDone;
+		FragTx.Pending=0;
+		FragTx.Failed=FALSE;
+		FragTx.Time=0;
+		FragTx.Busy=TRUE;
+		NWK_FragTxSend();
+		
+		//       
+		if (FragTx.Offset==0){
+			FragTx.Busy=FALSE;
+			return FAIL;
 		};
-	uint8_t len=0;
+		return SUCCESS;
+	};
+
+	// NPDU     ,       
+	RESULT status = FAIL;
+	NetBuf *Buf = NetBuf_Alloc();
+	uint8_t *Npdu = (Buf!=NULL)?NetBuf_Put(Buf,NWK_HEADER_SIZE+NsduLength):NULL;
+	
+	if (Npdu!=NULL){
 		//  307
 		//  Sequence number    beaconenabled ,     , 
 		//         NSDU = NsduHandle
-	 *((uint8_t*)(Buf+0))=NPDU_NWK_Data; 
-	 *((uint16_t*)(Buf+2))=DstAddr;
-	 *((uint16_t*)(Buf+4))=NodeParam.NetAdd;
-	 Buf[5]=0; //  ,    ,   
-	 Buf[6]=NsduHandle;
-	 len=7+ NsduLength;
+	 Npdu[0]=NPDU_NWK_Data; 
+	 Npdu[1]=0;
+	 *((uint16_t*)(Npdu+2))=DstAddr;
+	 *((uint16_t*)(Npdu+4))=NodeParam.NetAdd;
+	 Npdu[6]=NWK_Radius(DstAddr);
+	 Npdu[7]=NsduHandle;
 	//  . 
-	i=0;
-	while (i!=NsduLength){
-		Buf[7+i]=NsduData[i];
-		i++;
-	};
-	
-	uint64_t SentAdd;
-	SentAdd=getnext(DstAddr,NodeParam.NetAdd, NodeParam.Module);
+	memcpy(Npdu+NWK_HEADER_SIZE,NsduData,NsduLength);
 	
-	
-	BOOL status = Socket_Tx(SocketNWK,len,Buf,(uint8_t*)&SentAdd,MAC_SHORT_ADDRES_MODE,0,NWKTxPower);	
+	// NWK_TxDone     MAC 
+	status = NWK_TxBuf(Buf,getnext(DstAddr,NodeParam.NetAdd, NodeParam.Module),NWK_TxDone,NsduHandle);
+	}
+	else NetBuf_Free(Buf);
+
+return status;
+};
 
 
-	NWK_TxDone(status,NsduHandle,GetTime());
+//   NSDU   Root    , Root=0 -  
+// Radius    , NWK_TxDone     
+RESULT NWK_Broadcast_Tx(uint16_t Root, uint8_t Radius, uint16_t NsduLength, uint8_t NsduHandle, uint8_t *NsduData, 
+EVENT (*NWK_TxDone)(BOOL status, uint8_t NsduHandle, uint64_t TxTime)){
 
+	if ((NsduLength>MAX_NPDU_SIZE-NWK_BCAST_HEADER_SIZE)||(NsduLength==0)||(Radius==0)) return FAIL;
+	if (NWK_TxDone==0) return FAIL;
+	if (Thread_IsActive(RouterThread)==0) return FAIL;
 
+	RESULT status = FAIL;
+	NetBuf *Buf = NetBuf_Alloc();
+	uint8_t *Npdu = (Buf!=NULL)?NetBuf_Put(Buf,NWK_HEADER_SIZE+NWK_BCAST_HEADER_SIZE+NsduLength):NULL;
+	
+	if (Npdu!=NULL){
+		Npdu[0]=NPDU_NWK_Data;
+		Npdu[1]=NPDU_NWK_Broadcast;
+		*((uint16_t*)(Npdu+2))=Root;
+		*((uint16_t*)(Npdu+4))=NodeParam.NetAdd;
+		Npdu[6]=Radius;
+		Npdu[7]=NsduHandle;
+		Npdu[NWK_HEADER_SIZE]=++BcastSeq;
+		memcpy(Npdu+NWK_HEADER_SIZE+NWK_BCAST_HEADER_SIZE,NsduData,NsduLength);
+		
+		//  ,  ,    
+		NWK_BcastMark(NodeParam.NetAdd,BcastSeq);
+		status = NWK_TxBuf(Buf,MAC_BROADCAST_ADDR,NWK_TxDone,NsduHandle);
+	}
+	else NetBuf_Free(Buf);
 
+return status;
+};
 
 
+//    ,      
+void NWK_NeighbourCopy(NWKNeighbourEntry *N, NWKNeighbour *Neighbour){
+Neighbour->NetAdd=N->NetAdd;
+Neighbour->LongAdd=N->LongAdd;
+Neighbour->LQI=N->LQI>>NWK_EWMA_SHIFT;
+Neighbour->RSSI=N->RSSI/(1<<NWK_EWMA_SHIFT);
+Neighbour->TxRatio=N->TxRatio>>NWK_EWMA_SHIFT;
+Neighbour->LastHeard=N->LastHeard;
+};
 
+//       
+RESULT NWK_GetNeighbour(uint8_t Index, NWKNeighbour *Neighbour){
+if ((Index>=NWK_NEIGHBOUR_TABLE_SIZE)||(Neighbour==NULL)) return FAIL;
+if (Neighbours[Index].Valid==FALSE) return FAIL;
+NWK_NeighbourCopy(&Neighbours[Index],Neighbour);
+return SUCCESS;
+};
 
+//     
+RESULT NWK_FindNeighbour(uint16_t NetAdd, NWKNeighbour *Neighbour){
+NWKNeighbourEntry *N=NWK_NeighbourFind(NetAdd,0);
+if ((N==NULL)||(Neighbour==NULL)) return FAIL;
+NWK_NeighbourCopy(N,Neighbour);
 return SUCCESS;
 };
 
+//   
+RESULT NWK_GetDropCounts(uint16_t *RxDrops, uint16_t *RadiusDrops){
+if ((RxDrops==NULL)||(RadiusDrops==NULL)) return FAIL;
+BEGIN_CRITICAL_SECTION
+{
+	*RxDrops=RxDropCount;
+	*RadiusDrops=RadiusDropCount;
+}
+END_CRITICAL_SECTION
+return SUCCESS;
+};
 
 //   
 RESULT NWK_Set_TxPower(uint8_t TxPower){
@@ -936,9 +1981,23 @@ if (NWKProcFlag==0) return FAIL; //
 		NodeParam.NN=0;
 		Thread_Destroy (RouterThread); // 
 	
-	if (NodeParam.Coordinator==1){
-			Timer_Destroy(HelloTimer);
+	if (RepairFlag==1){
+			RepairFlag=0;
+			Timer_Destroy(RepairTimer);
 		};
+	
+	Timer_Destroy(HelloTimer);
+	
+	//    NSDU 
+	if (Agg.Length>0){
+		Agg.Length=0;
+		Timer_Destroy(AggTimer);
+	};
+	if (BcastTx.Length>0){
+		BcastTx.Length=0;
+		Timer_Destroy(BcastTimer);
+	};
+	ScanFlag=0;
 		
 		
 		
@@ -973,6 +2032,22 @@ typedef struct
 	uint8_t DestPort;
 }SocketDefsStruct;
 
+/// structure defines frame queued in MAC layer
+typedef struct
+{
+	/// frame buffer, NULL if MSDU handle is free
+	NetBuf *Buf;
+	
+	/// sending socket
+	int8_t Socket;
+	
+	/// "frame transmitted" event handler, may be NULL
+	EVENT (*Confirm)(uint8_t Tag,MAC_ENUM Status,uint64_t Timestamp);
+	
+	/// value passed to confirm event handler
+	uint8_t Tag;
+}SocketTxStruct;
+
 ///structure defines 
 typedef struct
 {
@@ -982,12 +2057,6 @@ typedef struct
 	/// channel
 	uint8_t Channel;
 	
-	/// MAC layer frame
-	MACLayerFrame TxFrame;
-	
-	/// dest address
-	uint8_t* DestAddress;
-	
 	/// sockets
 	SocketDefsStruct Sockets[MAX_NUM_PORTS];
 	
@@ -1000,11 +2069,8 @@ typedef struct
 	/// "stopped" event handler
 	EVENT (*Stopped)(void);
 	
-	/// tx data
-	uint8_t TxData[MAC_A_MAX_MAC_FRAME_SIZE];
-	
-	/// current sending socket
-	int8_t CurrentSendingSocket;
+	/// frames queued in MAC layer, indexed by MSDU handle
+	SocketTxStruct Tx[MAC_TX_QUEUE_SIZE];
 }NWKLayerDefsStruct;
 static volatile NWKLayerDefsStruct NWKLayerDefs;
 
@@ -1029,7 +2095,6 @@ RESULT NWKLayer_Init(void)
 	
 	NWKLayerDefs.Started     = NULL;
 	NWKLayerDefs.Stopped     = NULL;
-	NWKLayerDefs.DestAddress = 0;
 	
 	for(i=0;i<MAX_NUM_PORTS;++i)
 	{
@@ -1038,8 +2103,17 @@ RESULT NWKLayer_Init(void)
 		NWKLayerDefs.Sockets[i].DestPort = 0;
 	}
 	
-	NWKLayerDefs.ActivePortsMask      = 0;
-	NWKLayerDefs.CurrentSendingSocket = -1;
+	NWKLayerDefs.ActivePortsMask = 0;
+	
+	for(i=0;i<MAC_TX_QUEUE_SIZE;++i)
+	{
+		NWKLayerDefs.Tx[i].Buf     = NULL;
+		NWKLayerDefs.Tx[i].Socket  = -1;
+		NWKLayerDefs.Tx[i].Confirm = NULL;
+	}
+	
+	// init frame buffers
+	NetBuf_Init();
 	
 	// get MAC layer data
 	NWKLayerDefs.MACLayerDefs = MACLayer_GetDefs();
@@ -1111,8 +2185,18 @@ RESULT NWK_SetParams(uint64_t SrcAddr,uint8_t SrcAddrMode,uint16_t PanID,uint8_t
 	NWKLayerDefs.MACLayerDefs->ExtendedAddress = SrcAddr;
 	}
 	NWKLayerDefs.MACLayerDefs->PanID           = PanID;
+	
+	// radio is already on, switch it to the new channel
+	if(Channel!=NWKLayerDefs.Channel&&Radio_GetState()!=RADIO_STATE_POWER_DOWN)
+		PHYLayer_SET_Request(PHY_PIB_CURRENT_CHANNEL_ID,(uint32_t)Channel);
+	
 	NWKLayerDefs.Channel = Channel;
 	
+	// hardware address recognition must match MAC layer addresses
+	PHYLayer_SetAddress(NWKLayerDefs.MACLayerDefs->PanID,
+	                    NWKLayerDefs.MACLayerDefs->ShortAddress,
+	                    NWKLayerDefs.MACLayerDefs->ExtendedAddress);
+	
 	return SUCCESS;
 }
 
@@ -1121,7 +2205,6 @@ RESULT NWK_SetParams(uint64_t SrcAddr,uint8_t SrcAddrMode,uint16_t PanID,uint8_t
  **********************************************************************************/
 RESULT NWK_Start(EVENT (*Started)(void))
 {
-	uint8_t Seed;
 	SAVE_GUARD_STATE
 	
 	Guard_Idle();
@@ -1147,12 +2230,13 @@ RESULT NWK_Start(EVENT (*Started)(void))
 	// set "started" event handler
 	NWKLayerDefs.Started = Started;
 	
-	// init randomizer
-	Seed = Utils_CKSUM(8,(uint8_t*)&NWKLayerDefs.MACLayerDefs->ExtendedAddress);
-	Utils_Seed(Seed);
+	// init randomizer with whole extended address, RSSI noise is added
+	// when the radio is on
+	Utils_Seed((uint32_t)NWKLayerDefs.MACLayerDefs->ExtendedAddress^
+	           (uint32_t)(NWKLayerDefs.MACLayerDefs->ExtendedAddress>>32));
 	
 	// init MAC layer DSN
-	NWKLayerDefs.MACLayerDefs->DSN = Seed;
+	NWKLayerDefs.MACLayerDefs->DSN = (uint8_t)Utils_Rand32();
 	
 	// turn on the radio
 	if(Radio_SetState(RADIO_STATE_POWER_UP)==FAIL)
@@ -1283,74 +2367,152 @@ RESULT Socket_Destroy(HSocket Socket)
 RESULT Socket_Tx(HSocket Socket,uint8_t Length,uint8_t *Data,
                  uint8_t* DestAddress,uint8_t DstAddrMode,uint8_t DestPort,uint8_t TxPower)
 {
-	uint8_t i;
-	int8_t LocalCurrentSendingSocket;
+	NetBuf *Buf;
+	uint8_t *Payload;
+	
+	// check data
+	if(Data==NULL)
+		return FAIL;
+	
+	// check length
+	if(Length>(MAC_A_MAX_MAC_FRAME_SIZE-3))
+		return FAIL;
+	
+	// get frame buffer
+	Buf = NetBuf_Alloc();
+	if(Buf==NULL)
+		return FAIL;
+	
+	// copy data
+	Payload = NetBuf_Put(Buf,Length);
+	if(Payload==NULL)
+	{
+		NetBuf_Free(Buf);
+		return FAIL;
+		
+	}
+	
+	memcpy(Payload,Data,Length);
+	
+	// send frame buffer
+	return Socket_TxBuf(Socket,Buf,DestAddress,DstAddrMode,DestPort,TxPower,NULL,0);
+}
+
+/*******************************************************************************//**
+ * @implements Socket_TxBuf
+ **********************************************************************************/
+RESULT Socket_TxBuf(HSocket Socket,NetBuf *Buf,
+                    uint8_t* DestAddress,uint8_t DstAddrMode,uint8_t DestPort,uint8_t TxPower,
+                    EVENT (*Confirm)(uint8_t Tag,MAC_ENUM Status,uint64_t Timestamp),uint8_t Tag)
+{
+	MACLayerFrame Frame;
+	uint8_t *Header;
+	uint8_t Handle;
+	
+	// check frame buffer
+	if(Buf==NULL)
+		return FAIL;
 	
 	// check radio state
 	if(Radio_GetState()==RADIO_STATE_POWER_DOWN)
+	{
+		NetBuf_Free(Buf);
 		return FAIL;
+		
+	}
 	
 	// check MAC layer data
 	if(NWKLayerDefs.MACLayerDefs==NULL)
+	{
+		NetBuf_Free(Buf);
 		return FAIL;
+		
+	}
 	
 	// check socket handle
 	if(Socket>MAX_NUM_PORTS)
+	{
+		NetBuf_Free(Buf);
 		return FAIL;
+		
+	}
 	
 	if(!(NWKLayerDefs.ActivePortsMask&(1<<Socket)))
+	{
+		NetBuf_Free(Buf);
 		return FAIL;
-	
-	// check data
-	if(Data==NULL)
-		return FAIL;
+		
+	}
 	
 	// check length
-	if(Length>(MAC_A_MAX_MAC_FRAME_SIZE-3))
+	if(Buf->Length>(MAC_A_MAX_MAC_FRAME_SIZE-3))
+	{
+		NetBuf_Free(Buf);
 		return FAIL;
+		
+	}
 	
-	// get sending socket value
+	// reserve MSDU handle
 	BEGIN_CRITICAL_SECTION
 	{
-		LocalCurrentSendingSocket = NWKLayerDefs.CurrentSendingSocket;
-		NWKLayerDefs.CurrentSendingSocket = Socket;
+		for(Handle=0;Handle<MAC_TX_QUEUE_SIZE;++Handle)
+		{
+			if(NWKLayerDefs.Tx[Handle].Buf==NULL)
+			{
+				NWKLayerDefs.Tx[Handle].Buf     = Buf;
+				NWKLayerDefs.Tx[Handle].Socket  = Socket;
+				NWKLayerDefs.Tx[Handle].Confirm = Confirm;
+				NWKLayerDefs.Tx[Handle].Tag     = Tag;
+				break;
+				
+			}
+			
+		}
 	}
 	END_CRITICAL_SECTION
 	
 	// check it
-	if(LocalCurrentSendingSocket>=0)
+	if(Handle==MAC_TX_QUEUE_SIZE)
+	{
+		NetBuf_Free(Buf);
 		return FAIL;
+		
+	}
 	
-	// set dest address
-	NWKLayerDefs.DestAddress = DestAddress;
-	
-	// set data
-	NWKLayerDefs.TxData[0] = DestPort;
-	NWKLayerDefs.TxData[1] = Socket;
+	// prepend ports
+	Header = NetBuf_Push(Buf,2);
+	if(Header==NULL)
+	{
+		NWKLayerDefs.Tx[Handle].Buf = NULL;
+		NetBuf_Free(Buf);
+		return FAIL;
+		
+	}
 	
-	// copy data
-	for(i=0;i<Length;++i)
-		NWKLayerDefs.TxData[i+2] = Data[i];
+	Header[0] = DestPort;
+	Header[1] = Socket;
 	
-	// compute checksum
-	NWKLayerDefs.TxData[Length+2] = Utils_CKSUM(Length+2,(uint8_t*)NWKLayerDefs.TxData);
+	// append checksum
+	Header[Buf->Length] = Utils_CKSUM(Buf->Length,Header);
+	NetBuf_Put(Buf,1);
 	
-	// set frame params
-	NWKLayerDefs.TxFrame.SrcAddrMode = DstAddrMode;
-	NWKLayerDefs.TxFrame.SrcPanID    = NWKLayerDefs.MACLayerDefs->PanID;
+	// set frame params, MAC layer copies addresses into the buffer
+	Frame.SrcAddrMode = DstAddrMode;
+	Frame.SrcPanID    = NWKLayerDefs.MACLayerDefs->PanID;
 	if(DstAddrMode==0x02)
 	{
-	NWKLayerDefs.TxFrame.SrcAddr     = (uint8_t*)&NWKLayerDefs.MACLayerDefs->ShortAddress;
+	Frame.SrcAddr     = (uint8_t*)&NWKLayerDefs.MACLayerDefs->ShortAddress;
 	}
 	else
 	{
-	NWKLayerDefs.TxFrame.SrcAddr     = (uint8_t*)&NWKLayerDefs.MACLayerDefs->ExtendedAddress;
+	Frame.SrcAddr     = (uint8_t*)&NWKLayerDefs.MACLayerDefs->ExtendedAddress;
 	}
-	NWKLayerDefs.TxFrame.DstAddrMode = DstAddrMode;
-	NWKLayerDefs.TxFrame.DstPanID    = NWKLayerDefs.MACLayerDefs->PanID;
-	NWKLayerDefs.TxFrame.DstAddr     = NWKLayerDefs.DestAddress;
-	NWKLayerDefs.TxFrame.Length      = Length + 3;
-	NWKLayerDefs.TxFrame.Data        = (uint8_t*)NWKLayerDefs.TxData;
+	Frame.DstAddrMode = DstAddrMode;
+	Frame.DstPanID    = NWKLayerDefs.MACLayerDefs->PanID;
+	Frame.DstAddr     = DestAddress;
+	Frame.Length      = Buf->Length;
+	Frame.Data        = NETBUF_DATA(Buf);
+	Frame.Buf         = Buf;
 	
 	SAVE_GUARD_STATE
 	
@@ -1359,15 +2521,19 @@ RESULT Socket_Tx(HSocket Socket,uint8_t Length,uint8_t *Data,
 	// set tx power
 	if(PHYLayer_SET_Request(PHY_PIB_TX_POWER_ID,TxPower)==FAIL)
 	{
-		NWKLayerDefs.CurrentSendingSocket = -1;
+		NWKLayerDefs.Tx[Handle].Buf = NULL;
+		NetBuf_Free(Buf);
+		RESTORE_GUARD_STATE
 		return FAIL;
 		
 	}
 	
-	// send data
-	if(MACLayer_DATA_Request((MACLayerFrame*)&NWKLayerDefs.TxFrame,0,0)==FAIL)
+	// queue data, buffer is freed when transmission is confirmed
+	if(MACLayer_DATA_Request(&Frame,Handle,MAC_TX_OPTION_ACK)==FAIL)
 	{
-		NWKLayerDefs.CurrentSendingSocket = -1;
+		NWKLayerDefs.Tx[Handle].Buf = NULL;
+		NetBuf_Free(Buf);
+		RESTORE_GUARD_STATE
 		return FAIL;
 		
 	}
@@ -1381,35 +2547,43 @@ RESULT Socket_Tx(HSocket Socket,uint8_t Length,uint8_t *Data,
 /*******************************************************************************//**
  * @implements MACLayer_DATA_Confirm
  **********************************************************************************/
-EVENT MACLayer_DATA_Confirm(uint8_t Handle,MAC_ENUM Status)
+EVENT MACLayer_DATA_Confirm(uint8_t Handle,MAC_ENUM Status,uint64_t Timestamp)
 {
+	NetBuf *Buf;
+	int8_t Socket;
+	EVENT (*Confirm)(uint8_t Tag,MAC_ENUM Status,uint64_t Timestamp);
+	uint8_t Tag;
+	
+	// check MSDU handle
+	if(Handle>=MAC_TX_QUEUE_SIZE)
+		return;
+	
 	SAVE_GUARD_STATE
 	
 	Guard_Watch();
 	
-	int8_t Tmp = NWKLayerDefs.CurrentSendingSocket;
-	NWKLayerDefs.CurrentSendingSocket = -1;
-	
-	if(Status==MAC_SUCCESS)
+	// release MSDU handle
+	BEGIN_CRITICAL_SECTION
 	{
-		
-		if(Tmp>=0&&Tmp<MAX_NUM_PORTS)
-		{
-			if(NWKLayerDefs.Sockets[Tmp].TxDone!=NULL)
-				NWKLayerDefs.Sockets[Tmp].TxDone(SUCCESS);
-			
-		}
-		
+		Buf     = NWKLayerDefs.Tx[Handle].Buf;
+		Socket  = NWKLayerDefs.Tx[Handle].Socket;
+		Confirm = NWKLayerDefs.Tx[Handle].Confirm;
+		Tag     = NWKLayerDefs.Tx[Handle].Tag;
+		NWKLayerDefs.Tx[Handle].Buf = NULL;
 	}
-	else
+	END_CRITICAL_SECTION
+	
+	// frame buffer is not needed any more
+	NetBuf_Free(Buf);
+	
+	// confirm this frame
+	if(Confirm!=NULL)
+		Confirm(Tag,Status,Timestamp);
+	
+	if(Socket>=0&&Socket<MAX_NUM_PORTS)
 	{
-		
-		if(Tmp>=0&&Tmp<MAX_NUM_PORTS)
-		{
-			if(NWKLayerDefs.Sockets[Tmp].TxDone!=NULL)
-				NWKLayerDefs.Sockets[Tmp].TxDone(FAIL);
-			
-		}
+		if(NWKLayerDefs.Sockets[Socket].TxDone!=NULL)
+			NWKLayerDefs.Sockets[Socket].TxDone((Status==MAC_SUCCESS)?SUCCESS:FAIL);
 		
 	}
 	
@@ -1417,6 +2591,25 @@ EVENT MACLayer_DATA_Confirm(uint8_t Handle,MAC_ENUM Status)
 	
 }
 
+/*******************************************************************************//**
+ * @implements MACLayer_ED_SCAN_Confirm
+ **********************************************************************************/
+EVENT MACLayer_ED_SCAN_Confirm(MAC_ENUM Status,uint32_t UnscannedChannels,
+                               int8_t *EnergyDetectList)
+{
+	SAVE_GUARD_STATE
+	
+	Guard_Watch();
+	
+	// radio is left on the last scanned channel, return it to NWK channel
+	PHYLayer_SET_Request(PHY_PIB_CURRENT_CHANNEL_ID,(uint32_t)NWKLayerDefs.Channel);
+	
+	NWK_EDScanDone(UnscannedChannels,EnergyDetectList);
+	
+	RESTORE_GUARD_STATE
+	
+}
+
 /*******************************************************************************//**
  * @implements MACLayer_DATA_Indication
  **********************************************************************************/
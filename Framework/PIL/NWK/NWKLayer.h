@@ -9,6 +9,82 @@
 
 #include "../../PIL/Defs.h"
 #include "../../PIL/NWK/MAC/MACLayerDefs.h"
+#include "../../PIL/NWK/MAC/MACLayer.h"
+#include "../../PIL/NWK/NetBuf.h"
+#include "../../API/NWKAPI.h"
+
+/// number of received NPDUs NWK layer can queue for processing
+#ifndef NWK_RX_QUEUE_SIZE
+#define NWK_RX_QUEUE_SIZE 2
+#endif
+
+/// maximum NSDU size, NSDUs not fitting in one frame are fragmented
+#ifndef NWK_MAX_NSDU_SIZE
+#define NWK_MAX_NSDU_SIZE 256
+#endif
+
+/// number of NSDUs NWK layer can reassemble at the same time, each one takes
+/// NWK_MAX_NSDU_SIZE bytes of RAM, 0 disables reassembly and fragments are dropped,
+/// so it should be enabled on nodes which receive NSDUs not fitting in one frame
+#ifndef NWK_REASSEMBLY_POOL_SIZE
+#define NWK_REASSEMBLY_POOL_SIZE 0
+#endif
+
+/// time in milli seconds after which incomplete NSDU may be discarded
+#ifndef NWK_REASSEMBLY_TIMEOUT
+#define NWK_REASSEMBLY_TIMEOUT 2000
+#endif
+
+/// time in milli seconds router holds data bound for its parent to send it
+/// in one frame with other NSDUs, 0 disables aggregation
+#ifndef NWK_AGGREGATION_WINDOW
+#define NWK_AGGREGATION_WINDOW 0
+#endif
+
+/// number of broadcasts NWK layer remembers to suppress duplicates
+#ifndef NWK_BCAST_SEEN_SIZE
+#define NWK_BCAST_SEEN_SIZE 8
+#endif
+
+/// time in milli seconds broadcast is remembered
+#ifndef NWK_BCAST_SEEN_TIMEOUT
+#define NWK_BCAST_SEEN_TIMEOUT 5000
+#endif
+
+/// maximum random delay in milli seconds before broadcast is relayed
+#ifndef NWK_BCAST_JITTER
+#define NWK_BCAST_JITTER 30
+#endif
+
+/// channels NWK_StartCrd and NWK_Join scan when they are given channel 0
+#ifndef NWK_SCAN_CHANNELS
+#define NWK_SCAN_CHANNELS MAC_ALL_CHANNELS
+#endif
+
+/// time in milli seconds coordinator measures energy of each scanned channel
+#ifndef NWK_SCAN_DURATION
+#define NWK_SCAN_DURATION 100
+#endif
+
+/// number of neighbours NWK layer tracks link quality of
+#ifndef NWK_NEIGHBOUR_TABLE_SIZE
+#define NWK_NEIGHBOUR_TABLE_SIZE 8
+#endif
+
+/// number of times Hello interval doubles while network does not change
+#ifndef NWK_HELLO_MAX_EXP
+#define NWK_HELLO_MAX_EXP 4
+#endif
+
+/// upper bound of Hello interval in milli seconds
+#ifndef NWK_HELLO_MAX_PERIOD
+#define NWK_HELLO_MAX_PERIOD 2000000ul
+#endif
+
+/// number of next hops NWK layer caches for tree routing
+#ifndef NWK_ROUTE_CACHE_SIZE
+#define NWK_ROUTE_CACHE_SIZE 8
+#endif
 
 /// radio transceiver states
 typedef enum
@@ -32,6 +108,26 @@ MACLayerDefsStruct* MACLayer_GetDefs(void);
  **********************************************************************************/
 RESULT NWKLayer_Init(void);
 
+/*******************************************************************************//**
+ * sends frame buffer via socket, socket header is prepended in the headroom of
+ * the buffer, buffer is freed when transmission ends or if it fails to start
+ * @param[in] Socket      socket handle
+ * @param[in] Buf         frame buffer allocated by NetBuf_Alloc
+ * @param[in] DestAddress destination address
+ * @param[in] DstAddrMode destination address mode
+ * @param[in] DestPort    destination port
+ * @param[in] TxPower     transmission power
+ * @param[in] Confirm     event handler signalled with MAC status and SFD time when
+ *                        transmission of this buffer ends, may be NULL, it is not
+ *                        signalled if FAIL is returned
+ * @param[in] Tag         value passed to Confirm
+ * @return SUCCESS if data transmission successfully started
+ * @return FAIL    otherwise
+ **********************************************************************************/
+RESULT Socket_TxBuf(HSocket Socket,NetBuf *Buf,
+                    uint8_t *DestAddress,uint8_t DstAddrMode,uint8_t DestPort,uint8_t TxPower,
+                    EVENT (*Confirm)(uint8_t Tag,MAC_ENUM Status,uint64_t Timestamp),uint8_t Tag);
+
 /*******************************************************************************//**
  * turns on or off the radio transceiver
  * @param[in] State state of the radio transceiver
@@ -0,0 +1,102 @@
+/**
+ * @file NetBuf.c
+ * NWK frame buffer implementation source file.
+ * @author Nezametdinov I.E.
+ */
+
+#include "../../PIL/NWK/NetBuf.h"
+#include "../../API/CommonAPI.h"
+
+/// pool of frame buffers
+static NetBuf Pool[NETBUF_POOL_SIZE];
+
+/*******************************************************************************//**
+ * @implements NetBuf_Init
+ **********************************************************************************/
+void NetBuf_Init(void)
+{
+	uint8_t i;
+	
+	for(i=0;i<NETBUF_POOL_SIZE;++i)
+		Pool[i].Used = FALSE;
+	
+}
+
+/*******************************************************************************//**
+ * @implements NetBuf_Alloc
+ **********************************************************************************/
+NetBuf* NetBuf_Alloc(void)
+{
+	NetBuf *Buf = NULL;
+	uint8_t i;
+	
+	BEGIN_CRITICAL_SECTION
+	{
+		// find free buffer
+		for(i=0;i<NETBUF_POOL_SIZE;++i)
+		{
+			if(!Pool[i].Used)
+			{
+				Buf = &Pool[i];
+				Buf->Used = TRUE;
+				break;
+				
+			}
+			
+		}
+		
+	}
+	END_CRITICAL_SECTION
+	
+	// reserve headroom
+	if(Buf!=NULL)
+	{
+		Buf->Offset = NETBUF_HEADROOM;
+		Buf->Length = 0;
+		
+	}
+	
+	return Buf;
+}
+
+/*******************************************************************************//**
+ * @implements NetBuf_Free
+ **********************************************************************************/
+void NetBuf_Free(NetBuf *Buf)
+{
+	if(Buf!=NULL)
+		Buf->Used = FALSE;
+	
+}
+
+/*******************************************************************************//**
+ * @implements NetBuf_Push
+ **********************************************************************************/
+uint8_t* NetBuf_Push(NetBuf *Buf,uint8_t Length)
+{
+	// check headroom
+	if(Buf->Offset<Length)
+		return NULL;
+	
+	Buf->Offset -= Length;
+	Buf->Length += Length;
+	
+	return NETBUF_DATA(Buf);
+}
+
+/*******************************************************************************//**
+ * @implements NetBuf_Put
+ **********************************************************************************/
+uint8_t* NetBuf_Put(NetBuf *Buf,uint8_t Length)
+{
+	uint8_t *Tail;
+	
+	// check tailroom
+	if((uint16_t)Buf->Offset+Buf->Length+Length>PHY_A_MAX_PHY_PACKET_SIZE)
+		return NULL;
+	
+	Tail = NETBUF_DATA(Buf)+Buf->Length;
+	Buf->Length += Length;
+	
+	return Tail;
+}
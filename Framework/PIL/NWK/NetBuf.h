@@ -0,0 +1,80 @@
+/**
+ * @file NetBuf.h
+ * NWK frame buffer header.
+ * @author Nezametdinov I.E.
+ */
+
+#ifndef __NET_BUF_H__
+#define __NET_BUF_H__
+
+#include "../../PIL/NWK/PHY/PHYLayer.h"
+#include "../../PIL/Defs.h"
+
+/// space reserved in front of data for socket header (2 bytes) and
+/// the longest MAC header with PAN ID compression (21 bytes)
+#ifndef NETBUF_HEADROOM
+#define NETBUF_HEADROOM 23
+#endif
+
+/// number of frame buffers, one for every frame in MAC tx queue
+#ifndef NETBUF_POOL_SIZE
+#define NETBUF_POOL_SIZE 3
+#endif
+
+/// returns pointer to the first data byte of frame buffer
+#define NETBUF_DATA(x) ((x)->Mem+(x)->Offset)
+
+/// structure defines frame buffer, each layer prepends its header in
+/// the headroom, so data is written only once
+typedef struct
+{
+	/// buffer is allocated
+	BOOL Used;
+	
+	/// offset of the first data byte
+	uint8_t Offset;
+	
+	/// data length
+	uint8_t Length;
+	
+	/// buffer memory
+	uint8_t Mem[PHY_A_MAX_PHY_PACKET_SIZE];
+}NetBuf;
+
+/*******************************************************************************//**
+ * inits frame buffers
+ **********************************************************************************/
+void NetBuf_Init(void);
+
+/*******************************************************************************//**
+ * allocates frame buffer with NETBUF_HEADROOM bytes of headroom and no data
+ * @return frame buffer if there is a free one
+ * @return NULL         otherwise
+ **********************************************************************************/
+NetBuf* NetBuf_Alloc(void);
+
+/*******************************************************************************//**
+ * frees frame buffer
+ * @param[in] Buf frame buffer
+ **********************************************************************************/
+void NetBuf_Free(NetBuf *Buf);
+
+/*******************************************************************************//**
+ * prepends space for header in front of data
+ * @param[in] Buf    frame buffer
+ * @param[in] Length header length
+ * @return pointer to the header if there is enough headroom
+ * @return NULL                  otherwise
+ **********************************************************************************/
+uint8_t* NetBuf_Push(NetBuf *Buf,uint8_t Length);
+
+/*******************************************************************************//**
+ * appends space for data after the end of data
+ * @param[in] Buf    frame buffer
+ * @param[in] Length length of data to append
+ * @return pointer to the appended space if there is enough tailroom
+ * @return NULL                          otherwise
+ **********************************************************************************/
+uint8_t* NetBuf_Put(NetBuf *Buf,uint8_t Length);
+
+#endif
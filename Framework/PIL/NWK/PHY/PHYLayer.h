@@ -58,6 +58,8 @@ enum
 	PHY_A_MAX_PHY_PACKET_SIZE = 127,
 	/// turnaround time
 	PHY_A_TURNAROUND_TIME     = 12,
+	/// symbol duration in micro seconds, 2450 MHz PHY
+	PHY_SYMBOL_DURATION       = 16
 };
 
 /*******************************************************************************//**
@@ -116,6 +118,30 @@ RESULT PHYLayer_CCA_Request(void);
  **********************************************************************************/
 EVENT PHYLayer_CCA_Confirm(PHY_ENUM Status);
 
+#ifdef PHY_LAYER_HANDLE_CCA_TX
+
+/*******************************************************************************//**
+ * loads PSDU to transceiver, so PHYLayer_CCATX_Request transmits it without delay,
+ * must not be called from interrupt
+ * @param[in] Length PSDU length
+ * @param[in] Data   PSDU
+ * @return SUCCESS if PSDU successfully loaded
+ * @return FAIL    otherwise
+ **********************************************************************************/
+RESULT PHYLayer_LoadTx(uint8_t Length,uint8_t *Data);
+
+/*******************************************************************************//**
+ * performs CCA and transmits loaded PSDU if channel is idle, transceiver does both
+ * at once, may be called from interrupt. PHYLayer_CCA_Confirm is signalled with
+ * PHY_IDLE if transmission started, PHYLayer_DATA_Confirm is signalled when it
+ * ends then
+ * @return SUCCESS if request successfully accepted
+ * @return FAIL    otherwise
+ **********************************************************************************/
+RESULT PHYLayer_CCATX_Request(void);
+
+#endif
+
 /*******************************************************************************//**
  * PLME-ED.request
  * IEEE802.15.4 paragraph - 6.2.2.3
@@ -209,9 +235,28 @@ RESULT PHYLayer_SET_Request(PHY_PIB_ATTRIBUTE_PARAM PIBAttribute,
 EVENT PHYLayer_SET_Confirm(PHY_ENUM Status,PHY_PIB_ATTRIBUTE_PARAM PIBAttribute);
 
 /*******************************************************************************//**
- * returns last SFD time in micro seconds
+ * returns last SFD time in micro seconds, during PD-DATA.indication it is SFD time
+ * of the indicated frame, during PD-DATA.confirm it is SFD time of the transmitted
+ * frame
  * @return last SFD time
  **********************************************************************************/
 uint64_t PHYLayer_GetLastSFDTime(void);
 
+/*******************************************************************************//**
+ * returns RSSI of the last received frame in dBm, during PD-DATA.indication it is
+ * RSSI of the indicated frame
+ * @return last RSSI
+ **********************************************************************************/
+int8_t PHYLayer_GetLastRSSI(void);
+
+/*******************************************************************************//**
+ * sets addresses of the device, if PHY_LAYER_HANDLE_ACK is defined, transceiver
+ * accepts only frames addressed to them and acknowledges frames which request it
+ * @param[in] PanID           PAN ID
+ * @param[in] ShortAddress    short address
+ * @param[in] ExtendedAddress extended address
+ **********************************************************************************/
+void PHYLayer_SetAddress(uint16_t PanID,MAC_SHORT_ADDR ShortAddress,
+                         MAC_EXTENDED_ADDR ExtendedAddress);
+
 #endif
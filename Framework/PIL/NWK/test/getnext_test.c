@@ -0,0 +1,231 @@
+/**
+ * @file getnext_test.c
+ * Host test and benchmark of tree routing in Getprnt.c.
+ * Next hops are compared with the original algorithm (with getdeep fixed)
+ * for every destination address and several modules.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "../../Defs.h"
+
+/// cache size used by NWK layer by default
+#ifndef NWK_ROUTE_CACHE_SIZE
+#define NWK_ROUTE_CACHE_SIZE 8
+#endif
+
+#include "../Getprnt.c"
+
+/// modules under test
+static const uint16_t Modules[] = {2,3,4,5,7,14,255};
+#define NUM_MODULES (sizeof(Modules)/sizeof(Modules[0]))
+
+/// number of host addresses checked per module
+#define NUM_HOSTS 10
+
+/// number of errors found
+static unsigned long Errors = 0;
+
+/*******************************************************************************//**
+ * original getnext with fixed getdeep, coordinator branch walks from the current
+ * hop instead of D, otherwise it never terminates
+ **********************************************************************************/
+static uint16_t RefGetNext(uint16_t D,uint16_t H,uint16_t m)
+{
+	uint16_t DeepHost = getdeep(H,m);
+	uint16_t DeepDst  = getdeep(D,m);
+	uint16_t NextHop;
+
+	if(H==0)
+	{
+		NextHop = D;
+		while(getdeep(NextHop,m)>1)
+			NextHop = getprnt(NextHop,m);
+
+		return NextHop;
+	}
+
+	if(DeepHost>=DeepDst)
+		return getprnt(H,m);
+
+	NextHop = D;
+	while(DeepHost!=(DeepDst-1))
+	{
+		NextHop = getprnt(NextHop,m);
+		DeepDst = getdeep(NextHop,m);
+	}
+
+	if(getprnt(NextHop,m)==H)
+		return NextHop;
+
+	return getprnt(H,m);
+}
+
+/*******************************************************************************//**
+ * original getnext with original getdeep, which always returns 1
+ **********************************************************************************/
+static uint16_t OldGetNext(uint16_t D,uint16_t H,uint16_t m)
+{
+	if(H==0)
+		return D;
+
+	return getprnt(H,m);
+}
+
+/*******************************************************************************//**
+ * fills host addresses at different depths of the tree
+ **********************************************************************************/
+static void GetHosts(uint16_t m,uint16_t *Hosts)
+{
+	uint32_t A = 0;
+	uint8_t i = 0;
+
+	// coordinator, its first and last child
+	Hosts[i++] = 0;
+	Hosts[i++] = 1;
+	Hosts[i++] = m;
+
+	// first and last node at each depth while they fit
+	while(i<NUM_HOSTS-1)
+	{
+		A = A*m+1;
+		if(A>0xFFFF)
+			break;
+
+		Hosts[i++] = (uint16_t)A;
+		if(A*m+m<=0xFFFF&&i<NUM_HOSTS-1)
+			Hosts[i++] = (uint16_t)(A*m+m);
+	}
+
+	// padding and the last address
+	while(i<NUM_HOSTS)
+		Hosts[i++] = 0xFFFF;
+}
+
+/*******************************************************************************//**
+ * reports mismatch
+ **********************************************************************************/
+static void Fail(const char *What,uint16_t D,uint16_t H,uint16_t m,
+                 uint16_t Got,uint16_t Expected)
+{
+	if(Errors++<20)
+		printf("FAIL %s: D=%u H=%u m=%u got %u expected %u\n",
+		       What,D,H,m,Got,Expected);
+}
+
+/*******************************************************************************//**
+ * compares next hops of all destinations for the host
+ * @return number of next hops which differ from the original getdeep ones
+ **********************************************************************************/
+static unsigned long CheckHost(uint16_t H,uint16_t m)
+{
+	unsigned long Changed = 0;
+	uint32_t D;
+	uint16_t Next,Ref;
+
+	for(D=0;D<=0xFFFF;++D)
+	{
+		// frames to the node itself are never routed, getnext returns the node
+		if(D==H)
+		{
+			Next = getnext(D,H,m);
+			if(Next!=H)
+				Fail("self",D,H,m,Next,H);
+
+			continue;
+		}
+
+		Ref  = RefGetNext(D,H,m);
+
+		// cache miss
+		Next = getnext(D,H,m);
+		if(Next!=Ref)
+			Fail("miss",D,H,m,Next,Ref);
+
+		// cache hit
+		Next = getnext(D,H,m);
+		if(Next!=Ref)
+			Fail("hit",D,H,m,Next,Ref);
+
+		// entry is replaced by conflicting destination and filled again
+		getnext((uint16_t)(D+NWK_ROUTE_CACHE_SIZE),H,m);
+		Next = getnext(D,H,m);
+		if(Next!=Ref)
+			Fail("evict",D,H,m,Next,Ref);
+
+		if(OldGetNext(D,H,m)!=Ref)
+			++Changed;
+	}
+
+	return Changed;
+}
+
+/*******************************************************************************//**
+ * checks that cache is flushed when host address or module changes
+ **********************************************************************************/
+static void CheckFlush(void)
+{
+	uint16_t D = 1000,Next;
+
+	getnext(D,0,2);
+	Next = getnext(D,1,2);
+	if(Next!=RefGetNext(D,1,2))
+		Fail("host change",D,1,2,Next,RefGetNext(D,1,2));
+
+	Next = getnext(D,1,3);
+	if(Next!=RefGetNext(D,1,3))
+		Fail("module change",D,1,3,Next,RefGetNext(D,1,3));
+}
+
+/*******************************************************************************//**
+ * measures average time of one call in nanoseconds
+ **********************************************************************************/
+static double Bench(uint16_t (*Fn)(uint16_t,uint16_t,uint16_t),
+                    uint16_t H,uint16_t m,BOOL Hit)
+{
+	volatile uint16_t Sink = 0;
+	unsigned long Calls = 0;
+	uint32_t D;
+	clock_t Start = clock();
+
+	for(D=0;D<=0xFFFF;++D,++Calls)
+		Sink += Fn(Hit?(uint16_t)(D&7):(uint16_t)D,H,m);
+
+	(void)Sink;
+	return (double)(clock()-Start)*1e9/CLOCKS_PER_SEC/Calls;
+}
+
+int main(void)
+{
+	uint16_t Hosts[NUM_HOSTS];
+	unsigned long Changed;
+	uint8_t i,j;
+
+	for(i=0;i<NUM_MODULES;++i)
+	{
+		GetHosts(Modules[i],Hosts);
+		Changed = 0;
+
+		for(j=0;j<NUM_HOSTS;++j)
+			Changed += CheckHost(Hosts[j],Modules[i]);
+
+		printf("m=%3u: %lu next hops differ from original getdeep\n",
+		       Modules[i],Changed);
+
+		printf("       ns per call: reference %.1f, uncached %.1f, cached %.1f\n",
+		       Bench(RefGetNext,Hosts[NUM_HOSTS/2],Modules[i],FALSE),
+		       Bench(getnext,Hosts[NUM_HOSTS/2],Modules[i],FALSE),
+		       Bench(getnext,Hosts[NUM_HOSTS/2],Modules[i],TRUE));
+	}
+
+	CheckFlush();
+
+	if(Errors!=0)
+	{
+		printf("%lu errors\n",Errors);
+		return 1;
+	}
+
+	printf("OK\n");
+	return 0;
+}
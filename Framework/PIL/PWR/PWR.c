@@ -5,6 +5,7 @@
  */
 
 #include "../../PIL/Scheduler/Scheduler.h"
+#include "../../API/PWRAPI.h"
 #include "../../PIL/Sensors/Sensors.h"
 #include "../../PIL/Buttons/Buttons.h"
 #include "../../PIL/Timers/Timers.h"
@@ -17,13 +18,22 @@
 #include "../../PIL/TWI/TWI.h"
 #include "../../PIL/OWI/OWI.h"
 
+/// min period of time which is worth entering power save mode when OS idles
+#ifndef PWR_MIN_POWER_SAVE_PERIOD
+#define PWR_MIN_POWER_SAVE_PERIOD MS(100)
+#endif
+
 /// thread for handling power management
 static volatile HThread Thread = INVALID_HANDLE;
 
+/// power save mode is allowed when OS idles
+static volatile BOOL AutoPowerSave = FALSE;
+
 /*******************************************************************************//**
- * power management thread proc
+ * saves state of all OS components, enters power save mode for the period set by
+ * MCU_SetPowerSavePeriod and restores OS components after waking up
  **********************************************************************************/
-PROC PWR_ThreadProc(PARAM Param)
+static void PWR_EnterPowerSave(void)
 {
 	// prepare all OS components to enter power save mode
 	// radio
@@ -123,6 +133,14 @@ PROC PWR_ThreadProc(PARAM Param)
 	
 }
 
+/*******************************************************************************//**
+ * power management thread proc
+ **********************************************************************************/
+PROC PWR_ThreadProc(PARAM Param)
+{
+	PWR_EnterPowerSave();
+}
+
 /*******************************************************************************//**
  * @implements PWR_Init
  **********************************************************************************/
@@ -144,3 +162,52 @@ void PWR_PowerSave(TIME Period)
 	MCU_SetPowerSavePeriod(Period);
 	Thread_Start(Thread,THREAD_TASK_MODE);
 }
+
+/*******************************************************************************//**
+ * @implements PWR_Idle
+ **********************************************************************************/
+void PWR_Idle(void)
+{
+	#ifdef USE_TIMERS
+	PERIOD TimeLeft;
+	
+	// enter power save mode only if the next timer deadline is far enough,
+	// without active timers only interrupts can wake MCU up, so it idles
+	if(AutoPowerSave)
+	{
+		TimeLeft = Timers_GetTimeLeft();
+		if(TimeLeft>=PWR_MIN_POWER_SAVE_PERIOD&&TimeLeft!=MAX_TIMEOUT)
+		{
+			// sleep until the next timer deadline, power save timer wakes MCU up
+			// earlier rather than later, so timers are never late, any thread
+			// posted by interrupt wakes MCU up too
+			MCU_SetPowerSavePeriod(TimeLeft);
+			MCU_EnableInterrupts();
+			PWR_EnterPowerSave();
+			MCU_DisableInterrupts();
+			return;
+			
+		}
+		
+	}
+	#endif
+	
+	// sleep until interrupt happens
+	MCU_Idle();
+}
+
+/*******************************************************************************//**
+ * @implements PWR_SetAutoPowerSave
+ **********************************************************************************/
+void PWR_SetAutoPowerSave(BOOL Enable)
+{
+	AutoPowerSave = Enable;
+}
+
+/*******************************************************************************//**
+ * @implements PWR_GetAutoPowerSave
+ **********************************************************************************/
+BOOL PWR_GetAutoPowerSave(void)
+{
+	return AutoPowerSave;
+}
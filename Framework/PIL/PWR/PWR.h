@@ -22,4 +22,11 @@ RESULT PWR_Init(void);
  **********************************************************************************/
 void PWR_PowerSave(TIME Period);
 
+/*******************************************************************************//**
+ * puts MCU to sleep until the next event, called by scheduler with interrupts
+ * disabled when there are no ready threads, MCU enters power save mode if it is
+ * allowed and the next timer deadline is far enough, otherwise it enters idle mode
+ **********************************************************************************/
+void PWR_Idle(void);
+
 #endif
@@ -8,20 +8,37 @@
 #include "../../API/SchedulerAPI.h"
 #include "../../API/CommonAPI.h"
 #include "../../PIL/MCU/MCU.h"
+#include "../../PIL/PWR/PWR.h"
 #include "../../PIL/Guard.h"
 
 #define THREAD_ACTIVITY      0x01
 #define THREAD_ACTIVITY_MODE 0x02
 #define THREAD_ACCESS_RIGHTS 0x04
+#define THREAD_EVENT_DRIVEN  0x08
+#define THREAD_QUEUED        0x10
+#define THREAD_PRIORITY_BITS 0x60
+
+#define THREAD_PRIORITY_SHIFT 5
+#define THREAD_PRIORITY_PARAMS_SHIFT 2
+#define NUM_THREAD_PRIORITIES 4
 
 #define THREAD_EXISTS(Thread)                ((Thread.ThreadIndex)<MAX_THREADS)
 #define THREAD_IS_SYSTEM_THREAD(Thread)      ((Thread.ThreadState)&THREAD_ACCESS_RIGHTS)
 #define THREAD_IS_IN_TASK_MODE(Thread)       ((Thread.ThreadState)&THREAD_ACTIVITY_MODE)
 #define THREAD_IS_ACTIVE(Thread)             ((Thread.ThreadState)&THREAD_ACTIVITY)
+#define THREAD_IS_IN_EVENT_MODE(Thread)      ((Thread.ThreadState)&THREAD_EVENT_DRIVEN)
+#define THREAD_IS_QUEUED(Thread)             ((Thread.ThreadState)&THREAD_QUEUED)
+#define THREAD_PRIORITY(Thread)              (((Thread.ThreadState)&THREAD_PRIORITY_BITS)>>THREAD_PRIORITY_SHIFT)
 #define THREAD_ACTIVATE(Thread)              {Thread.ThreadState |= THREAD_ACTIVITY;}
 #define THREAD_DEACTIVATE(Thread)            {Thread.ThreadState &= ~THREAD_ACTIVITY;}
 #define THREAD_SET_TASK_MODE(Thread)         {Thread.ThreadState |= THREAD_ACTIVITY_MODE;}
 #define THREAD_SET_PROCESS_MODE(Thread)      {Thread.ThreadState &= ~THREAD_ACTIVITY_MODE;}
+#define THREAD_SET_EVENT_MODE(Thread)        {Thread.ThreadState |= THREAD_EVENT_DRIVEN;}
+#define THREAD_CLEAR_EVENT_MODE(Thread)      {Thread.ThreadState &= ~THREAD_EVENT_DRIVEN;}
+#define THREAD_SET_QUEUED(Thread)            {Thread.ThreadState |= THREAD_QUEUED;}
+#define THREAD_CLEAR_QUEUED(Thread)          {Thread.ThreadState &= ~THREAD_QUEUED;}
+#define THREAD_SET_PRIORITY(Thread,Priority) {Thread.ThreadState = (Thread.ThreadState&~THREAD_PRIORITY_BITS)|\
+                                              ((Priority)<<THREAD_PRIORITY_SHIFT);}
 #define THREAD_SET_SYS_ACCESS_RIGHTS(Thread) {Thread.ThreadState |= THREAD_ACCESS_RIGHTS;}
 #define THREAD_SET_APP_ACCESS_RIGHTS(Thread) {Thread.ThreadState &= ~THREAD_ACCESS_RIGHTS;}
 
@@ -40,6 +57,9 @@ typedef struct
 	/// state of thread
 	uint8_t ThreadState;
 	
+	/// next thread in ready queue
+	uint8_t NextReady;
+	
 }ThreadDefsStruct;
 
 /// array of threads
@@ -54,6 +74,114 @@ static volatile uint8_t CurrentThreadIndex = 0;
 /// handle of the thread wich is processed right now
 static volatile HThread CurrentThread = INVALID_HANDLE;
 
+/// first threads in ready queues of every priority
+static volatile HThread ReadyHead[NUM_THREAD_PRIORITIES];
+
+/// last threads in ready queues of every priority
+static volatile HThread ReadyTail[NUM_THREAD_PRIORITIES];
+
+/*******************************************************************************//**
+ * puts thread to the tail of ready queue of its priority, must be called with
+ * interrupts disabled
+ * @param[in] Thread thread handle
+ **********************************************************************************/
+static void Scheduler_Enqueue(HThread Thread)
+{
+	uint8_t Priority;
+	
+	// thread is already waiting in ready queue
+	if(THREAD_IS_QUEUED(ThreadsDefs[Thread]))
+		return;
+	
+	THREAD_SET_QUEUED(ThreadsDefs[Thread])
+	ThreadsDefs[Thread].NextReady = INVALID_HANDLE;
+	
+	// link thread to the tail of the queue
+	Priority = THREAD_PRIORITY(ThreadsDefs[Thread]);
+	if(IS_INVALID_HANDLE(ReadyTail[Priority]))
+		ReadyHead[Priority] = Thread;
+	else
+		ThreadsDefs[ReadyTail[Priority]].NextReady = Thread;
+	
+	ReadyTail[Priority] = Thread;
+}
+
+/*******************************************************************************//**
+ * takes thread from the head of the highest priority nonempty ready queue,
+ * must be called with interrupts disabled
+ * @return handle of the ready thread
+ * @return INVALID_HANDLE if there are no ready threads
+ **********************************************************************************/
+static HThread Scheduler_Dequeue(void)
+{
+	HThread Thread;
+	uint8_t Priority = NUM_THREAD_PRIORITIES;
+	
+	// find the highest priority nonempty queue
+	while(Priority>0)
+	{
+		--Priority;
+		Thread = ReadyHead[Priority];
+		
+		if(IS_INVALID_HANDLE(Thread))
+			continue;
+		
+		// unlink thread from the head of the queue
+		ReadyHead[Priority] = ThreadsDefs[Thread].NextReady;
+		if(IS_INVALID_HANDLE(ReadyHead[Priority]))
+			ReadyTail[Priority] = INVALID_HANDLE;
+		
+		THREAD_CLEAR_QUEUED(ThreadsDefs[Thread])
+		
+		return Thread;
+	}
+	
+	// all queues are empty
+	return INVALID_HANDLE;
+}
+
+/*******************************************************************************//**
+ * removes thread from ready queue, must be called with interrupts disabled,
+ * thread priority may have changed since it was queued, so all queues are searched
+ * @param[in] Thread thread handle
+ **********************************************************************************/
+static void Scheduler_Unlink(HThread Thread)
+{
+	HThread Prev,Cur;
+	uint8_t Priority;
+	
+	// thread is not in ready queue
+	if(!THREAD_IS_QUEUED(ThreadsDefs[Thread]))
+		return;
+	
+	THREAD_CLEAR_QUEUED(ThreadsDefs[Thread])
+	
+	for(Priority=0;Priority<NUM_THREAD_PRIORITIES;++Priority)
+	{
+		// find thread and its predecessor in the queue
+		Prev = INVALID_HANDLE;
+		for(Cur=ReadyHead[Priority];!IS_INVALID_HANDLE(Cur)&&Cur!=Thread;
+		    Cur=ThreadsDefs[Cur].NextReady)
+			Prev = Cur;
+		
+		if(IS_INVALID_HANDLE(Cur))
+			continue;
+		
+		// unlink thread
+		if(IS_INVALID_HANDLE(Prev))
+			ReadyHead[Priority] = ThreadsDefs[Thread].NextReady;
+		else
+			ThreadsDefs[Prev].NextReady = ThreadsDefs[Thread].NextReady;
+		
+		if(ReadyTail[Priority]==Thread)
+			ReadyTail[Priority] = Prev;
+		
+		ThreadsDefs[Thread].NextReady = INVALID_HANDLE;
+		return;
+	}
+	
+}
+
 /*******************************************************************************//**
  * @implements Scheduler_Init
  **********************************************************************************/
@@ -68,9 +196,16 @@ RESULT Scheduler_Init(void)
 		ThreadsDefs[i].Param       = NULL;
 		ThreadsDefs[i].ThreadIndex = MAX_THREADS;
 		ThreadsDefs[i].ThreadState = 0;
+		ThreadsDefs[i].NextReady   = INVALID_HANDLE;
 		ThreadsArray[i] = i;
 	}
 	
+	for(i=0;i<NUM_THREAD_PRIORITIES;++i)
+	{
+		ReadyHead[i] = INVALID_HANDLE;
+		ReadyTail[i] = INVALID_HANDLE;
+	}
+	
 	CurrentThread = INVALID_HANDLE;
 	CurrentThreadIndex  = 0;
 	
@@ -82,50 +217,81 @@ RESULT Scheduler_Init(void)
  **********************************************************************************/
 void Scheduler_RunThreads(void)
 {
-	uint8_t i;
+	HThread Thread;
 	
 	// eternal loop
 	while(TRUE)
 	{
-		// loop through all existing threads
-		for(i=0;i<CurrentThreadIndex;++i)
+		// this is a system block of code, so guard may idle
+		Guard_Idle();
+		
+		// get the next ready thread
+		MCU_DisableInterrupts();
+		Thread = Scheduler_Dequeue();
+		
+		// if there are no ready threads, then sleep until interrupt happens or
+		// until the next timer deadline if power management is used
+		if(IS_INVALID_HANDLE(Thread))
 		{
-			// this is a system block of code, so guard may idle
-			Guard_Idle();
-			
-			// get thread from threads array
-			CurrentThread = ThreadsArray[i];
-			
-			// if thread is not active or does not exist, then skip it
-			if(!THREAD_EXISTS(ThreadsDefs[CurrentThread])||
-			   !THREAD_IS_ACTIVE(ThreadsDefs[CurrentThread]))
-				continue;
-			
-			// if thread is in a task mode, then stop it
-			if(THREAD_IS_IN_TASK_MODE(ThreadsDefs[CurrentThread]))
-				THREAD_DEACTIVATE(ThreadsDefs[CurrentThread])
-			
-			// if thread proc is not specified, then skip thread
-			if(ThreadsDefs[CurrentThread].Proc==NULL)
-				continue;
-			
-			// enable interrupts
-			MCU_EnableInterrupts();
-			
-			// if current thread is a not a system thread, then
-			// guard should watch for it
-			if(!THREAD_IS_SYSTEM_THREAD(ThreadsDefs[CurrentThread]))
-				Guard_Watch();
-			
-			// process thread proc
-			ThreadsDefs[CurrentThread].Proc(ThreadsDefs[CurrentThread].Param);
-			
+			#ifdef USE_PWR
+			PWR_Idle();
+			#else
+			MCU_Idle();
+			#endif
+			continue;
 		}
 		
+		CurrentThread = Thread;
+		
+		// if thread is not active or does not exist, then skip it
+		if(!THREAD_EXISTS(ThreadsDefs[CurrentThread])||
+		   !THREAD_IS_ACTIVE(ThreadsDefs[CurrentThread]))
+			continue;
+		
+		// if thread is in a task mode, then stop it
+		if(THREAD_IS_IN_TASK_MODE(ThreadsDefs[CurrentThread]))
+			THREAD_DEACTIVATE(ThreadsDefs[CurrentThread])
+		
+		// if thread proc is not specified, then skip thread
+		if(ThreadsDefs[CurrentThread].Proc==NULL)
+			continue;
+		
+		// enable interrupts
+		MCU_EnableInterrupts();
+		
+		// if current thread is a not a system thread, then
+		// guard should watch for it
+		if(!THREAD_IS_SYSTEM_THREAD(ThreadsDefs[CurrentThread]))
+			Guard_Watch();
+		
+		// process thread proc
+		ThreadsDefs[CurrentThread].Proc(ThreadsDefs[CurrentThread].Param);
+		
+		// process thread is always ready, so put it to the tail of ready queue
+		MCU_DisableInterrupts();
+		if(THREAD_EXISTS(ThreadsDefs[Thread])&&THREAD_IS_ACTIVE(ThreadsDefs[Thread])&&
+		   !THREAD_IS_IN_TASK_MODE(ThreadsDefs[Thread])&&
+		   !THREAD_IS_IN_EVENT_MODE(ThreadsDefs[Thread]))
+			Scheduler_Enqueue(Thread);
+		
 	}
 	
 }
 
+/*******************************************************************************//**
+ * @implements Scheduler_IsIdle
+ **********************************************************************************/
+BOOL Scheduler_IsIdle(void)
+{
+	uint8_t Priority;
+	
+	for(Priority=0;Priority<NUM_THREAD_PRIORITIES;++Priority)
+		if(!IS_INVALID_HANDLE(ReadyHead[Priority]))
+			return FALSE;
+	
+	return TRUE;
+}
+
 /*******************************************************************************//**
  * @implements Thread_Create
  **********************************************************************************/
@@ -161,8 +327,13 @@ HThread Thread_Create(PROC (*Proc)(PARAM Param),PARAM Param)
 			else
 				THREAD_SET_APP_ACCESS_RIGHTS(ThreadsDefs[Thread])
 			
-			// deactivate thread
+			// deactivate thread, handle may have been used by destroyed thread,
+			// so its queue state, mode and priority are reset
 			THREAD_DEACTIVATE(ThreadsDefs[Thread])
+			THREAD_CLEAR_QUEUED(ThreadsDefs[Thread])
+			THREAD_CLEAR_EVENT_MODE(ThreadsDefs[Thread])
+			THREAD_SET_PRIORITY(ThreadsDefs[Thread],0)
+			ThreadsDefs[Thread].NextReady = INVALID_HANDLE;
 			
 			// inc index of the next thread in array of threads
 			++CurrentThreadIndex;
@@ -211,6 +382,10 @@ RESULT Thread_Destroy(HThread Thread)
 			// mark thread as not existing
 			ThreadsDefs[Thread].ThreadIndex = MAX_THREADS;
 			
+			// thread can not stay in ready queue, because its handle
+			// is given to the next created thread
+			Scheduler_Unlink(Thread);
+			
 		}
 		
 	}
@@ -239,13 +414,57 @@ RESULT Thread_Start(HThread Thread,uint8_t Params)
 		return FAIL;
 	
 	// define type of the thread
-	if(Params&THREAD_PROCESS_MODE)
+	if(Params&THREAD_EVENT_MODE)
+	{
+		THREAD_SET_PROCESS_MODE(ThreadsDefs[Thread])
+		THREAD_SET_EVENT_MODE(ThreadsDefs[Thread])
+	}
+	else if(Params&THREAD_PROCESS_MODE)
+	{
 		THREAD_SET_PROCESS_MODE(ThreadsDefs[Thread])
+		THREAD_CLEAR_EVENT_MODE(ThreadsDefs[Thread])
+	}
 	else
+	{
 		THREAD_SET_TASK_MODE(ThreadsDefs[Thread])
+		THREAD_CLEAR_EVENT_MODE(ThreadsDefs[Thread])
+	}
+	
+	BEGIN_CRITICAL_SECTION
+	{
+		// set priority of the thread, if thread is already queued,
+		// new priority will be used next time
+		THREAD_SET_PRIORITY(ThreadsDefs[Thread],(Params&THREAD_PRIORITY_HIGHEST)>>THREAD_PRIORITY_PARAMS_SHIFT)
+		
+		// activate the thread and let it run once
+		THREAD_ACTIVATE(ThreadsDefs[Thread])
+		Scheduler_Enqueue(Thread);
+	}
+	END_CRITICAL_SECTION
+	
+	// return success
+	return SUCCESS;
+}
+
+/*******************************************************************************//**
+ * @implements Thread_Post
+ **********************************************************************************/
+RESULT Thread_Post(HThread Thread)
+{
+	// if thread handle is not valid return failure
+	if(Thread>=MAX_THREADS)
+		return FAIL;
 	
-	// activate the thread
-	THREAD_ACTIVATE(ThreadsDefs[Thread])
+	// if thread is not active or does not exist, then return failure
+	if(!THREAD_EXISTS(ThreadsDefs[Thread])||!THREAD_IS_ACTIVE(ThreadsDefs[Thread]))
+		return FAIL;
+	
+	// put thread to ready queue
+	BEGIN_CRITICAL_SECTION
+	{
+		Scheduler_Enqueue(Thread);
+	}
+	END_CRITICAL_SECTION
 	
 	// return success
 	return SUCCESS;
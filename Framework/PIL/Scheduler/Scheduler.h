@@ -21,4 +21,11 @@ RESULT Scheduler_Init(void);
  **********************************************************************************/
 void Scheduler_RunThreads(void);
 
+/*******************************************************************************//**
+ * checks if there are no ready threads, must be called with interrupts disabled
+ * @return TRUE  if ready queue is empty
+ * @return FALSE otherwise
+ **********************************************************************************/
+BOOL Scheduler_IsIdle(void);
+
 #endif
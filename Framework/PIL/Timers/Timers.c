@@ -6,6 +6,7 @@
 
 #include "../../PIL/Timers/HardwareTimer.h"
 #include "../../PIL/Timers/Timers.h"
+#include "../../API/SchedulerAPI.h"
 #include "../../API/CommonAPI.h"
 #include "../../API/TimersAPI.h"
 #include "../../PIL/Guard.h"
@@ -13,6 +14,7 @@
 #define TIMER_ACTIVITY      0x01
 #define TIMER_ACTIVITY_MODE 0x02
 #define TIMER_ACCESS_RIGHTS 0x04
+#define TIMER_CONTEXT_MODE  0x08
 
 #define TIMER_EXISTS(Timer)                      ((Timer.TimerIndex)<MAX_TIMERS)
 #define TIMER_IS_SYSTEM_TIMER(Timer)             ((Timer.TimerState)&TIMER_ACCESS_RIGHTS)
@@ -24,6 +26,13 @@
 #define TIMER_SET_CYCLIC_MODE(Timer)             {Timer.TimerState &= ~TIMER_ACTIVITY_MODE;}
 #define TIMER_SET_SYS_ACCESS_RIGHTS(Timer)       {Timer.TimerState |= TIMER_ACCESS_RIGHTS;}
 #define TIMER_SET_APP_ACCESS_RIGHTS(Timer)       {Timer.TimerState &= ~TIMER_ACCESS_RIGHTS;}
+#define TIMER_IS_IN_INTERRUPT_MODE(Timer)        ((Timer.TimerState)&TIMER_CONTEXT_MODE)
+#define TIMER_SET_INTERRUPT_MODE(Timer)          {Timer.TimerState |= TIMER_CONTEXT_MODE;}
+#define TIMER_SET_THREAD_MODE(Timer)             {Timer.TimerState &= ~TIMER_CONTEXT_MODE;}
+#define TIMER_IS_QUEUED(Timer)                   ((Timer.HeapIndex)<MAX_TIMERS)
+
+#define DEADLINE_IS_EARLIER(x,y) (((int32_t)((x)-(y)))<0)
+#define TIMER_DEADLINE(i)        (TimersDefs[TimersHeap[i]].Deadline)
 
 /// structure defines timer
 typedef struct
@@ -34,8 +43,8 @@ typedef struct
 	/// timer parameter
 	PARAM Param;
 	
-	/// time left
-	PERIOD TimeLeft;
+	/// time when timer fires (lower 32 bits of system time)
+	uint32_t Deadline;
 	
 	/// timeout
 	PERIOD Timeout;
@@ -45,14 +54,14 @@ typedef struct
 	
 	/// state of timer
 	uint8_t  TimerState;
+	
+	/// index in queue of active timers
+	uint8_t  HeapIndex;
 }TimerDefsStruct;
 
 /// array of timers
 static volatile TimerDefsStruct TimersDefs[MAX_TIMERS];
 
-/// min timeout of all active timers in micro seconds
-static volatile PERIOD MinTimeout = MAX_TIMEOUT;
-
 /// array of timers
 static volatile uint8_t TimersArray[MAX_TIMERS];
 
@@ -62,81 +71,261 @@ static volatile uint8_t CurrentTimerIndex = 0;
 /// handle of the timer wich is processed right now
 static volatile HTimer CurrentTimer = INVALID_HANDLE;
 
+/// queue of active timers (binary heap ordered by deadline)
+static volatile uint8_t TimersHeap[MAX_TIMERS];
+
+/// number of active timers
+static volatile uint8_t HeapSize = 0;
+
+/// timers which fired, but which event handlers are not run yet
+static volatile uint32_t PendingTimers = 0;
+
+/// thread for running timers event handlers
+static volatile HThread TimersThread = INVALID_HANDLE;
+
 /// system time
 static volatile TIME SystemTime = 0;
 
+/*******************************************************************************//**
+ * swaps two timers in the queue of active timers
+ * @param[in] i index of the first timer in the queue
+ * @param[in] j index of the second timer in the queue
+ **********************************************************************************/
+static void Timers_HeapSwap(uint8_t i,uint8_t j)
+{
+	uint8_t Timer = TimersHeap[i];
+	
+	TimersHeap[i] = TimersHeap[j];
+	TimersHeap[j] = Timer;
+	
+	TimersDefs[TimersHeap[i]].HeapIndex = i;
+	TimersDefs[TimersHeap[j]].HeapIndex = j;
+}
+
+/*******************************************************************************//**
+ * moves timer towards the head of the queue while its deadline is earlier
+ * @param[in] i index of the timer in the queue
+ **********************************************************************************/
+static void Timers_HeapSiftUp(uint8_t i)
+{
+	uint8_t Parent;
+	
+	while(i>0)
+	{
+		Parent = (i-1)>>1;
+		
+		if(!DEADLINE_IS_EARLIER(TIMER_DEADLINE(i),TIMER_DEADLINE(Parent)))
+			break;
+		
+		Timers_HeapSwap(i,Parent);
+		i = Parent;
+	}
+	
+}
+
+/*******************************************************************************//**
+ * moves timer towards the tail of the queue while its deadline is later
+ * @param[in] i index of the timer in the queue
+ **********************************************************************************/
+static void Timers_HeapSiftDown(uint8_t i)
+{
+	uint8_t Child;
+	
+	while((Child = (i<<1)+1)<HeapSize)
+	{
+		// select the child with earlier deadline
+		if(Child+1<HeapSize&&DEADLINE_IS_EARLIER(TIMER_DEADLINE(Child+1),TIMER_DEADLINE(Child)))
+			++Child;
+		
+		if(!DEADLINE_IS_EARLIER(TIMER_DEADLINE(Child),TIMER_DEADLINE(i)))
+			break;
+		
+		Timers_HeapSwap(i,Child);
+		i = Child;
+	}
+	
+}
+
+/*******************************************************************************//**
+ * puts timer to the queue of active timers, must be called with interrupts disabled
+ * @param[in] Timer timer handle
+ **********************************************************************************/
+static void Timers_HeapInsert(HTimer Timer)
+{
+	TimersHeap[HeapSize] = Timer;
+	TimersDefs[Timer].HeapIndex = HeapSize;
+	++HeapSize;
+	
+	Timers_HeapSiftUp(TimersDefs[Timer].HeapIndex);
+}
+
+/*******************************************************************************//**
+ * removes timer from the queue of active timers, must be called with interrupts
+ * disabled
+ * @param[in] Timer timer handle
+ **********************************************************************************/
+static void Timers_HeapRemove(HTimer Timer)
+{
+	uint8_t i = TimersDefs[Timer].HeapIndex;
+	HTimer Moved;
+	
+	TimersDefs[Timer].HeapIndex = MAX_TIMERS;
+	--HeapSize;
+	
+	// timer was the last one in the queue
+	if(i==HeapSize)
+		return;
+	
+	// put the last timer to the place of removed one
+	Moved = TimersHeap[HeapSize];
+	TimersHeap[i] = Moved;
+	TimersDefs[Moved].HeapIndex = i;
+	
+	Timers_HeapSiftUp(i);
+	Timers_HeapSiftDown(TimersDefs[Moved].HeapIndex);
+}
+
+/*******************************************************************************//**
+ * moves elapsed time of hardware timer to the system time and restarts hardware
+ * timer with the timeout of the earliest active timer, must be called with
+ * interrupts disabled
+ **********************************************************************************/
+static void Timers_Reschedule(void)
+{
+	PERIOD Timeout = MAX_TIMEOUT;
+	
+	// update system time
+	SystemTime += HardwareTimer_GetTimeElapsed();
+	
+	// compute timeout of the earliest timer
+	if(HeapSize>0)
+	{
+		Timeout = (PERIOD)(TIMER_DEADLINE(0)-(uint32_t)SystemTime);
+		
+		if(Timeout<MIN_TIMEOUT)
+			Timeout = MIN_TIMEOUT;
+		else if(Timeout>MAX_TIMEOUT)
+			Timeout = MAX_TIMEOUT;
+		
+	}
+	
+	// update hardware timer
+	HardwareTimer_Start(Timeout);
+}
+
 /*******************************************************************************//**
  * @implements HardwareTimer_Fired
  **********************************************************************************/
 EVENT HardwareTimer_Fired(void)
 {
-	uint8_t i;
-	PERIOD Timeout = MinTimeout;
+	uint32_t Now;
 	
 	// save current guard state
 	SAVE_GUARD_STATE
 	
-	// update system time
-	SystemTime += HardwareTimer_GetTimeout();
-	
-	// begin recomputation of min timeout of all active timers
-	MinTimeout = MAX_TIMEOUT;
+	// update system time, hardware timer is restarted so that
+	// GetTime works in event handlers
+	SystemTime += HardwareTimer_GetTimeElapsed();
+	HardwareTimer_Start(MAX_TIMEOUT);
+	Now = (uint32_t)SystemTime;
 	
-	// loop through all timers
-	for(i=0;i<CurrentTimerIndex;++i)
+	// fire all timers which deadline has come
+	while(HeapSize>0)
 	{
 		// this is a system block of code, so guard may idle
 		Guard_Idle();
 		
-		// get timer from array of timers
-		CurrentTimer = TimersArray[i];
+		// get the earliest timer
+		CurrentTimer = TimersHeap[0];
 		
-		// check timer activity
-		if(!TIMER_IS_ACTIVE(TimersDefs[CurrentTimer]))
-			continue;
+		// if its deadline has not come, then nothing to fire
+		if(DEADLINE_IS_EARLIER(Now,TimersDefs[CurrentTimer].Deadline))
+			break;
 		
-		// update timer
-		TimersDefs[CurrentTimer].TimeLeft -= HardwareTimer_GetTimeout();
+		Timers_HeapRemove(CurrentTimer);
 		
-		// if timeout happened
-		if(TimersDefs[CurrentTimer].TimeLeft<=0)
+		// if timer is in one shot mode then deactivate it
+		if(TIMER_IS_IN_ONE_SHOT_MODE(TimersDefs[CurrentTimer]))
+			TIMER_DEACTIVATE(TimersDefs[CurrentTimer])
+		// else compute the next deadline, missed periods are skipped
+		else
 		{
-			// clear time
-			TimersDefs[CurrentTimer].TimeLeft += TimersDefs[CurrentTimer].Timeout;
-			
-			// if timer is in one shot mode then deactivate it
-			if(TIMER_IS_IN_ONE_SHOT_MODE(TimersDefs[CurrentTimer]))
-				TIMER_DEACTIVATE(TimersDefs[CurrentTimer])
-			
-			// if event handler is specified run it
-			if(TimersDefs[CurrentTimer].Fired==NULL)
-				continue;
-			
-			// if current timer is a not a system timer, then
-			// guard should watch for it
-			if(!TIMER_IS_SYSTEM_TIMER(TimersDefs[CurrentTimer]))
-				Guard_Watch();
+			TimersDefs[CurrentTimer].Deadline += TimersDefs[CurrentTimer].Timeout;
+			if(!DEADLINE_IS_EARLIER(Now,TimersDefs[CurrentTimer].Deadline))
+				TimersDefs[CurrentTimer].Deadline = Now + TimersDefs[CurrentTimer].Timeout;
 			
-			// signal timer "fired" event
-			TimersDefs[CurrentTimer].Fired(TimersDefs[CurrentTimer].Param);
+			Timers_HeapInsert(CurrentTimer);
 			
 		}
-		// else compute new timeout
-		else
-			Timeout = TimersDefs[CurrentTimer].TimeLeft<Timeout?TimersDefs[CurrentTimer].TimeLeft:Timeout;
 		
-		// update min timeout
-		if(TIMER_IS_ACTIVE(TimersDefs[CurrentTimer])&&TimersDefs[CurrentTimer].Timeout<MinTimeout)
-			MinTimeout = TimersDefs[CurrentTimer].Timeout;
+		// if event handler is specified run it
+		if(TimersDefs[CurrentTimer].Fired==NULL)
+			continue;
+		
+		// event handler should be run in thread
+		if(!TIMER_IS_IN_INTERRUPT_MODE(TimersDefs[CurrentTimer]))
+		{
+			PendingTimers |= (1UL<<CurrentTimer);
+			Thread_Post(TimersThread);
+			continue;
+		}
+		
+		// if current timer is a not a system timer, then
+		// guard should watch for it
+		if(!TIMER_IS_SYSTEM_TIMER(TimersDefs[CurrentTimer]))
+			Guard_Watch();
+		
+		// signal timer "fired" event
+		TimersDefs[CurrentTimer].Fired(TimersDefs[CurrentTimer].Param);
 		
 	}
+	
 	// update hardware timer
-	HardwareTimer_Start(Timeout);
+	Timers_Reschedule();
 	
 	// restore previous guard state
 	RESTORE_GUARD_STATE
 }
 
+/*******************************************************************************//**
+ * timers thread proc, runs event handlers of fired timers
+ **********************************************************************************/
+PROC Timers_ThreadProc(PARAM Param)
+{
+	HTimer Timer;
+	BOOL Fired;
+	
+	// loop through all pending timers
+	for(Timer=0;Timer<MAX_TIMERS&&PendingTimers!=0;++Timer)
+	{
+		// this is a system block of code, so guard may idle
+		Guard_Idle();
+		
+		// timer might be stopped after it fired, so check it again
+		BEGIN_CRITICAL_SECTION
+		{
+			Fired = (PendingTimers&(1UL<<Timer))!=0;
+			PendingTimers &= ~(1UL<<Timer);
+		}
+		END_CRITICAL_SECTION
+		
+		if(!Fired)
+			continue;
+		
+		CurrentTimer = Timer;
+		
+		// if current timer is a not a system timer, then
+		// guard should watch for it
+		if(!TIMER_IS_SYSTEM_TIMER(TimersDefs[Timer]))
+			Guard_Watch();
+		
+		// signal timer "fired" event
+		TimersDefs[Timer].Fired(TimersDefs[Timer].Param);
+		
+	}
+	
+}
+
 /*******************************************************************************//**
  * @implements Timers_Init
  **********************************************************************************/
@@ -149,18 +338,29 @@ RESULT Timers_Init(void)
 	{
 		TimersDefs[i].Fired       = NULL;
 		TimersDefs[i].Param       = NULL;
-		TimersDefs[i].TimeLeft    = 0;
+		TimersDefs[i].Deadline    = 0;
 		TimersDefs[i].Timeout     = 0;
 		TimersDefs[i].TimerIndex  = MAX_TIMERS;
 		TimersDefs[i].TimerState  = 0;
+		TimersDefs[i].HeapIndex   = MAX_TIMERS;
 		TimersArray[i] = i;
 	}
 	
-	MinTimeout = MAX_TIMEOUT;
+	HeapSize = 0;
+	PendingTimers = 0;
 	CurrentTimerIndex = 0;
 	CurrentTimer = INVALID_HANDLE;
 	SystemTime = 0;
 	
+	// create thread
+	TimersThread = Thread_Create(Timers_ThreadProc,NULL);
+	if(IS_INVALID_HANDLE(TimersThread))
+		return FAIL;
+	
+	// start thread
+	if(Thread_Start(TimersThread,THREAD_EVENT_MODE|THREAD_PRIORITY_HIGH)==FAIL)
+		return FAIL;
+	
 	// init hardware timer
 	return HardwareTimer_Init();
 }
@@ -170,7 +370,36 @@ RESULT Timers_Init(void)
  **********************************************************************************/
 void Timers_UpdateClock(TIME Delta)
 {
-	SystemTime += Delta;
+	BEGIN_CRITICAL_SECTION
+	{
+		SystemTime += Delta;
+		
+		// timers which deadline has passed should fire as soon as possible
+		Timers_Reschedule();
+	}
+	END_CRITICAL_SECTION
+	
+}
+
+/*******************************************************************************//**
+ * @implements Timers_GetTimeLeft
+ **********************************************************************************/
+PERIOD Timers_GetTimeLeft(void)
+{
+	PERIOD TimeLeft;
+	
+	// event handlers are waiting to be run
+	if(PendingTimers!=0)
+		return 0;
+	
+	// there are no active timers
+	if(HeapSize==0)
+		return MAX_TIMEOUT;
+	
+	// compute time left before the earliest deadline
+	TimeLeft = (PERIOD)(TIMER_DEADLINE(0)-(uint32_t)GetTime());
+	
+	return TimeLeft>0?TimeLeft:0;
 }
 
 #ifdef USE_PWR
@@ -218,8 +447,8 @@ HTimer Timer_Create(EVENT (*Fired)(PARAM Param),PARAM Param)
 			// set timer parameter
 			TimersDefs[Timer].Param = Param;
 			
-			// clear elapsed time
-			TimersDefs[Timer].TimeLeft = 0;
+			// clear deadline
+			TimersDefs[Timer].Deadline = 0;
 			
 			// set zero timeout
 			TimersDefs[Timer].Timeout = 0;
@@ -272,6 +501,13 @@ RESULT Timer_Destroy(HTimer Timer)
 		// if timer exists, then destroy it
 		if(TIMER_EXISTS(TimersDefs[Timer]))
 		{
+			// remove timer from the queue of active timers
+			if(TIMER_IS_QUEUED(TimersDefs[Timer]))
+				Timers_HeapRemove(Timer);
+			
+			TIMER_DEACTIVATE(TimersDefs[Timer])
+			PendingTimers &= ~(1UL<<Timer);
+			
 			// dec index of next timer in array of existing timers
 			--CurrentTimerIndex;
 			
@@ -320,25 +556,32 @@ RESULT Timer_Start(HTimer Timer,uint8_t Params,PERIOD Timeout)
 	else
 		TIMER_SET_ONE_SHOT_MODE(TimersDefs[Timer])
 	
-	// init timer
-	TimersDefs[Timer].TimeLeft = Timeout;
-	TimersDefs[Timer].Timeout  = Timeout;
-	
-	// update min timeout
-	if(Timeout<MinTimeout)
-		MinTimeout = Timeout;
+	// define context of the event handler
+	if(Params&TIMER_INTERRUPT_MODE)
+		TIMER_SET_INTERRUPT_MODE(TimersDefs[Timer])
+	else
+		TIMER_SET_THREAD_MODE(TimersDefs[Timer])
 	
 	BEGIN_CRITICAL_SECTION
 	{
+		// previous fire of the timer is cancelled
+		PendingTimers &= ~(1UL<<Timer);
+		
+		// if timer is already active, then remove it from the queue
+		if(TIMER_IS_QUEUED(TimersDefs[Timer]))
+			Timers_HeapRemove(Timer);
+		
+		// init timer
+		TimersDefs[Timer].Timeout  = Timeout;
+		TimersDefs[Timer].Deadline = (uint32_t)GetTime() + Timeout;
+		
 		// activate the timer
 		TIMER_ACTIVATE(TimersDefs[Timer])
+		Timers_HeapInsert(Timer);
 		
-		// update hardware timer
-		PERIOD HWTimeLeft = HardwareTimer_GetTimeLeft();
-		PERIOD HWTimeElapsed = HardwareTimer_GetTimeElapsed();
-		TimersDefs[Timer].TimeLeft += HWTimeElapsed;
-		if(Timeout<HWTimeLeft)
-			HardwareTimer_Update(Timeout-HWTimeLeft);
+		// if timer is the earliest one, then update hardware timer
+		if(TimersHeap[0]==Timer)
+			Timers_Reschedule();
 	}
 	END_CRITICAL_SECTION
 	
@@ -355,8 +598,10 @@ RESULT Timer_Stop(HTimer Timer)
 	if(Timer>=MAX_TIMERS)
 		return FAIL;
 	
-	// if timer is not active or does not exist return failure
-	if(!TIMER_EXISTS(TimersDefs[Timer])||!TIMER_IS_ACTIVE(TimersDefs[Timer]))
+	// if timer is not active (and its event is not pending) or does not exist
+	// return failure
+	if(!TIMER_EXISTS(TimersDefs[Timer])||
+	   (!TIMER_IS_ACTIVE(TimersDefs[Timer])&&!(PendingTimers&(1UL<<Timer))))
 		return FAIL;
 	
 	// if timer is a system timer and guard is watching for a threat
@@ -364,8 +609,19 @@ RESULT Timer_Stop(HTimer Timer)
 	if(TIMER_IS_SYSTEM_TIMER(TimersDefs[Timer])&&Guard_IsWatching())
 		return FAIL;
 	
-	// deactivate timer
-	TIMER_DEACTIVATE(TimersDefs[Timer])
+	BEGIN_CRITICAL_SECTION
+	{
+		// deactivate timer
+		TIMER_DEACTIVATE(TimersDefs[Timer])
+		
+		// remove timer from the queue of active timers
+		if(TIMER_IS_QUEUED(TimersDefs[Timer]))
+			Timers_HeapRemove(Timer);
+		
+		// cancel pending event
+		PendingTimers &= ~(1UL<<Timer);
+	}
+	END_CRITICAL_SECTION
 	
 	// return success
 	return SUCCESS;
@@ -22,6 +22,14 @@ RESULT Timers_Init(void);
  **********************************************************************************/
 void Timers_UpdateClock(TIME Delta);
 
+/*******************************************************************************//**
+ * returns time left before the earliest active timer fires, must be called with
+ * interrupts disabled
+ * @return time left in micro seconds
+ * @return MAX_TIMEOUT if there are no active timers
+ **********************************************************************************/
+PERIOD Timers_GetTimeLeft(void);
+
 /*******************************************************************************//**
  * forces timers to enter power save mode
  **********************************************************************************/
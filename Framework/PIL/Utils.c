@@ -8,8 +8,11 @@
 #include "../PIL/MCU/MCU.h"
 #include "../PIL/Utils.h"
 
-/// seed for random value generator
-static volatile uint8_t CurrentRandValue = 0;
+/// initial state of random value generator, it must not be 0
+#define UTILS_RAND_INITIAL_STATE 2463534242UL
+
+/// state of xorshift32 random value generator
+static volatile uint32_t RandState = UTILS_RAND_INITIAL_STATE;
 
 /// saved global interrupts state
 BOOL InterruptsState = FALSE;
@@ -44,7 +47,7 @@ void EndCriticalSection(void)
  **********************************************************************************/
 RESULT Utils_Init(void)
 {
-	CurrentRandValue = 0;
+	RandState        = UTILS_RAND_INITIAL_STATE;
 	InterruptsState  = FALSE;
 	NTCSE = 0;
 	
@@ -54,26 +57,49 @@ RESULT Utils_Init(void)
 /*******************************************************************************//**
  * @implements Utils_Seed
  **********************************************************************************/
-void Utils_Seed(uint8_t Seed)
+void Utils_Seed(uint32_t Seed)
 {
-	CurrentRandValue = Seed;
+	BEGIN_CRITICAL_SECTION
+	{
+		// seed is mixed into state, so seeds from several sources add up
+		RandState ^= Seed;
+		if(RandState==0)
+			RandState = UTILS_RAND_INITIAL_STATE;
+	}
+	END_CRITICAL_SECTION
+	
+	Utils_Rand32();
+	
 }
 
 /*******************************************************************************//**
- * @implements Utils_Rand
+ * @implements Utils_Rand32
  **********************************************************************************/
-uint8_t Utils_Rand(uint8_t MaxValue)
+uint32_t Utils_Rand32(void)
 {
-	// generate random value
-	if(MaxValue!=0)
+	uint32_t Value;
+	
+	// xorshift32, it is called from interrupts too
+	BEGIN_CRITICAL_SECTION
 	{
-		CurrentRandValue = CurrentRandValue * 87 + 39;
-		
-		return (CurrentRandValue % MaxValue);
+		Value  = RandState;
+		Value ^= Value<<13;
+		Value ^= Value>>17;
+		Value ^= Value<<5;
+		RandState = Value;
 	}
+	END_CRITICAL_SECTION
 	
-	// return 0 if max value is 0
-	return 0;
+	return Value;
+}
+
+/*******************************************************************************//**
+ * @implements Utils_Rand
+ **********************************************************************************/
+uint8_t Utils_Rand(uint8_t MaxValue)
+{
+	// scale upper bits instead of taking remainder, so low bits do not bias result
+	return (uint8_t)(((Utils_Rand32()>>16)*MaxValue)>>16);
 }
 
 /*******************************************************************************//**
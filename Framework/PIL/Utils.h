@@ -17,16 +17,22 @@
 RESULT Utils_Init(void);
 
 /*******************************************************************************//**
- * sets seed for random value
+ * mixes seed into state of random value generator
  * @param[in] Seed seed
  **********************************************************************************/
-void Utils_Seed(uint8_t Seed);
+void Utils_Seed(uint32_t Seed);
 
 /*******************************************************************************//**
- * generates random value
- * @param[in] MaxValue max value wich may be generated
+ * generates 32 bit random value
  * @return random value
  **********************************************************************************/
+uint32_t Utils_Rand32(void);
+
+/*******************************************************************************//**
+ * generates random value
+ * @param[in] MaxValue upper bound of generated value, it is never generated
+ * @return random value from 0 to MaxValue-1, 0 if MaxValue is 0
+ **********************************************************************************/
 uint8_t Utils_Rand(uint8_t MaxValue);
 
 /*******************************************************************************//**
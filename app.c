@@ -76,6 +76,8 @@ EVENT TxDone(BOOL status, uint8_t NsduHandle, uint64_t TxTime){
 EVENT RxByte(uint8_t Byte){
 	UART_message = Byte;
 	UART_receive_flag = 1;
+	//будим основной поток
+	Thread_Post(Thread);
 }
 
 EVENT JoinDone(uint8_t status, uint16_t NetAdd, uint8_t Hello, uint8_t Module){
@@ -88,10 +90,11 @@ EVENT JoinDone(uint8_t status, uint16_t NetAdd, uint8_t Hello, uint8_t Module){
 	//itoa(NetAdd, buffer, 10);
 	//UART_Tx(UART, 2, buffer);
 	RADIO_status_flag = 1;
+	Thread_Post(Thread);
 }
 
 //обработчик события "данные приняты"
-EVENT Rx_Done(uint16_t DstAddr, uint16_t SrcAddr, uint8_t NsduLength, uint8_t *NsduData, uint8_t LinkQuality,uint64_t RxTime ){
+EVENT Rx_Done(uint16_t DstAddr, uint16_t SrcAddr, uint16_t NsduLength, uint8_t *NsduData, uint8_t LinkQuality,uint64_t RxTime ){
 	//for(k=0; k<NsduLength; k++)
 		//RADIO_receive_buffer[k]=*(NsduData+k);
 	////записываем длину принятого сообщения
@@ -131,7 +134,7 @@ EVENT Booted(){
 	NWK_DebugOn();
 	
 	Thread = Thread_Create(Thread_main,NULL);
-	Thread_Start(Thread,THREAD_PROCESS_MODE);
+	Thread_Start(Thread,THREAD_EVENT_MODE);
 }
 
 
@@ -154,16 +157,16 @@ void UART_parse_message(){
 			//уничтожаем поток
 			Thread_Destroy(Thread);
 			//запускаем координатор
-			if(NWK_StartCrd(0xb4,14,1,5,Rx_Done)==0x01){
+			if(NWK_StartCrd(0xb4,0,1,5,Rx_Done)==0x01){
 				UART_Tx(UART,strlen("This node is coordinator now\r\n"),(uint8_t*)"This node is coordinator now\r\n");	
 			}
 			//создаем новый поток для координатора
 			Thread_c = Thread_Create(Thread_coordinator,NULL);
-			Thread_Start(Thread_c,THREAD_PROCESS_MODE);
+			Thread_Start(Thread_c,THREAD_EVENT_MODE);
 		break;
 		case 'j':
 			//NWK_Join(0xb4, 14, 0x02, JoinDone, Rx_Done);
-			if(NWK_Join(0xb4, 14, 0x00, JoinDone, Rx_Done)==0x01){
+			if(NWK_Join(0xb4, 0, 0x00, JoinDone, Rx_Done)==0x01){
 				//UART_Tx(UART,strlen("Success join\r\n"),(uint8_t*)"Success join\r\n");	
 			}				
 		break;